@@ -1,6 +1,6 @@
 ; ISR_example.asm: a) Increments/decrements a BCD variable every half second using
-; an ISR for timer 2; b) Generates a 2kHz square wave at pin P1.7 using
-; an ISR for timer 0; and c) in the 'main' loop it displays the variable
+; an ISR for timer 2; b) Generates a 2kHz square wave at pin P0.5 using
+; the PWM2 output; and c) in the 'main' loop it displays the variable
 ; incremented/decremented using the ISR for timer 2 on the LCD.  Also resets it to 
 ; zero if the 'CLEAR' push button connected to P1.5 is pressed.
 $NOLIST
@@ -23,10 +23,23 @@ $LIST
 ;
 
 CLK           EQU 16600000 ; Microcontroller system frequency in Hz
-TIMER0_RATE   EQU 4096     ; 2048Hz squarewave (peak amplitude of CEM-1203 speaker)
-TIMER0_RELOAD EQU ((65536-(CLK/TIMER0_RATE)))
-TIMER2_RATE   EQU 1000     ; 1000Hz, for a timer tick of 1ms
-TIMER2_RELOAD EQU ((65536-(CLK/TIMER2_RATE)))
+BUZZER_RATE   EQU 2048     ; 2048Hz squarewave (peak amplitude of CEM-1203 speaker)
+BUZZER_PERIOD EQU (CLK/BUZZER_RATE) ; PWM period in clocks
+; Timer 2 interrupts only once per tick (half a second) instead of every millisecond.  At
+; CLK/512 a tick is TICK_COUNTS and TICK_REM/TICK_DEN timer counts: the ISR adds up the
+; fractions and makes one period a count longer whenever they reach a whole count.
+TICK_RATE     EQU 2        ; Ticks per second
+TICK_DEN      EQU (512*TICK_RATE)
+TICK_COUNTS   EQU (CLK/TICK_DEN)
+TICK_REM      EQU (CLK-TICK_COUNTS*TICK_DEN)
+
+; Timer 0 samples the buttons SCAN_RATE times a second.  A button must read the same for
+; four samples in a row (20ms) to count, and repeats if held.
+SCAN_RATE     EQU 200
+TIMER0_RELOAD EQU (0x10000-(CLK/12/SCAN_RATE)) ; Timer 0 clock is sysclk/12
+REPEAT_START  EQU 100      ; First repeat after 500ms...
+REPEAT_NEXT   EQU 20       ; ...then every 100ms
+KEY_QUEUE_SIZE EQU 8       ; Must be a power of two
 
 ;SETUP THE PUSH button
 ;-----------------------------------------------------------------------------------------------
@@ -38,7 +51,15 @@ Set_Hour_Button equ P1.2
 Set_Min_Button equ P1.1
 Set_Sec_Button equ P1.0
 
-SOUND_OUT equ P1.7
+; Button numbers in the key events.  Bit 7 of an event is set for a repeat.
+KEY_TIME_SEC  EQU 0
+KEY_TIME_MIN  EQU 1
+KEY_TIME_HOUR EQU 2
+KEY_SET_SEC   EQU 3
+KEY_SET_MIN   EQU 4
+KEY_SET_HOUR  EQU 5
+
+SOUND_OUT equ P0.5 ; PWM2 output, so the speaker no longer needs a 4096Hz interrupt
 ;-----------------------------------------------------------------------------------------------
 
 
@@ -72,7 +93,7 @@ org 0x002B
 
 ; In the 8051 we can define direct access variables starting at location 0x30 up to location 0x7F
 dseg at 0x30
-Count1ms:     ds 2 ; Used to determine when half second has passed
+Tick_Frac:    ds 2 ; Fraction of a timer count, in 1/TICK_DEN, carried to the next tick
 
 
 ;Define variable: ds=(data space) 1
@@ -88,6 +109,14 @@ set_hour_counter: ds 1
 Time_AP:       ds 1 ; AMPM
 Set_AP: ds 1 ; AMPM_alarm
 
+key_state: ds 1 ; Debounced buttons, a 1 for each button pressed
+key_ct0:   ds 1 ; Vertical counter: bit n of key_ct1:key_ct0 counts samples of button n
+key_ct1:   ds 1 ; that disagree with key_state
+key_rpt:   ds 1 ; Samples until the next repeat
+key_head:  ds 1 ; Next entry to write in key_queue (Timer0_ISR)
+key_tail:  ds 1 ; Next entry to read from key_queue (main loop)
+key_queue: ds KEY_QUEUE_SIZE
+
 AM: db 'AM', 0
 PM: db 'PM', 0
 
@@ -98,6 +127,7 @@ PM: db 'PM', 0
 ; instructions with these variables.  This is how you define a 1-bit variable:
 bseg
 half_seconds_flag: dbit 1 ; Set to one in the ISR every time 500 ms had passed
+half_sec_var: dbit 1 ; Set on the first half of each second
 
 ;Define variable: dbit=( declare a single bit variable) 1
 ;bseg, refers to a bit segment, a way to organize or group bit variables
@@ -115,6 +145,19 @@ set_hour_var: dbit 1
 bseg
 set_AP_var: dbit 1
 bseg
+beep_var: dbit 1 ; Alternates every tick: beep-silence-beep-silence
+bseg
+
+; Set by whatever changes a field, cleared when the main loop shows it on the LCD
+dirty_time_sec: dbit 1
+dirty_time_min: dbit 1
+dirty_time_hour: dbit 1
+dirty_time_AP: dbit 1
+dirty_set_sec: dbit 1
+dirty_set_min: dbit 1
+dirty_set_hour: dbit 1
+dirty_set_AP: dbit 1
+bseg
 
 ;-----------------------------------------------------------------------------------------------
 
@@ -143,22 +186,31 @@ Alarm_Message:    db 'Set :  :  :', 0
 ; for timer 0                     ;
 ;---------------------------------;
 Timer0_Init:
-	orl CKCON, #0b00001000 ; Input for timer 0 is sysclk/1
+	anl CKCON, #0b11110111 ; Input for timer 0 is sysclk/12
 	mov a, TMOD
 	anl a, #0xf0 ; 11110000 Clear the bits for timer 0
 	orl a, #0x01 ; 00000001 Configure timer 0 as 16-timer
 	mov TMOD, a
 	mov TH0, #high(TIMER0_RELOAD)
 	mov TL0, #low(TIMER0_RELOAD)
+	clr a
+	mov key_state, a
+	mov key_head, a
+	mov key_tail, a
+	mov key_ct0, #0xff
+	mov key_ct1, #0xff
+	mov key_rpt, #REPEAT_START
 	; Enable the timer and interrupts
     setb ET0  ; Enable timer 0 interrupt
     setb TR0  ; Start timer 0
 	ret
 
 ;---------------------------------;
-; ISR for timer 0.  Set to execute;
-; every 1/4096Hz to generate a    ;
-; 2048 Hz wave at pin SOUND_OUT   ;
+; ISR for timer 0.  Samples the   ;
+; six buttons together, debounces ;
+; them with a vertical counter    ;
+; and posts press and repeat      ;
+; events to key_queue.            ;
 ;---------------------------------;
 Timer0_ISR:
 	;clr TF0  ; According to the data sheet this is done for us already.
@@ -167,26 +219,180 @@ Timer0_ISR:
 	mov TH0, #high(TIMER0_RELOAD)
 	mov TL0, #low(TIMER0_RELOAD)
 	setb TR0
-
-    ;jnb - Jump if Bit Not Set:
-	;reti - Return from Interrupt:
-	;-----------------------------------------------------------------------------------------------
 	
-	jnb set_AP_var, reset_var
-	jnb set_sec_var, reset_var
-	jnb set_min_var, reset_var
-	jnb set_hour_var, reset_var
-    cpl SOUND_OUT
-	 ; Connect speaker the pin assigned to 'SOUND_OUT'!
+	push acc
+	push psw
+	push b
+	push AR0
+	push AR1
+	
+	; One bit per button, 1 if pressed (pin low)
+	mov c, Time_Sec_Button
+	mov acc.0, c
+	mov c, Time_Min_Button
+	mov acc.1, c
+	mov c, Time_Hour_Button
+	mov acc.2, c
+	mov c, Set_Sec_Button
+	mov acc.3, c
+	mov c, Set_Min_Button
+	mov acc.4, c
+	mov c, Set_Hour_Button
+	mov acc.5, c
+	orl a, #0b11000000
+	cpl a
+	
+	; Count the samples that disagree with key_state, for all the buttons at once.  A
+	; count is cleared when a sample agrees; when it rolls over the button has changed.
+	xrl a, key_state
+	mov b, a
+	anl a, key_ct0
+	cpl a
+	mov key_ct0, a ; ct0 = ~(ct0 & changed)
+	mov a, key_ct1
+	anl a, b
+	xrl a, key_ct0
+	mov key_ct1, a ; ct1 = ct0 ^ (ct1 & changed)
+	anl a, key_ct0
+	anl a, b
+	xrl key_state, a ; Flip the buttons whose counts rolled over
+	anl a, key_state ; Just pressed
+	mov b, #0
+	lcall Key_Post
+	
+	; Auto-repeat while any button is held
+	mov a, key_state
+	jnz Timer0_ISR_Held
+	mov key_rpt, #REPEAT_START
+	sjmp Timer0_ISR_Done
+Timer0_ISR_Held:
+	djnz key_rpt, Timer0_ISR_Done
+	mov key_rpt, #REPEAT_NEXT
+	mov b, #0x80
+	lcall Key_Post
+	
+Timer0_ISR_Done:
+	pop AR1
+	pop AR0
+	pop b
+	pop psw
+	pop acc
 	reti
 
-reset_var:
-	clr set_AP_var
-	clr set_sec_var
-	clr set_min_var
-	clr set_hour_var		
-	reti
+; Adds an event to key_queue for each 1 in A: the button number ORed with B.  If the
+; queue is full the event is lost.
+Key_Post:
+	mov R1, b
+Key_Post_Loop:
+	jz Key_Post_Done
+	clr c
+	rrc a
+	jnc Key_Post_Next
+	push acc
+	mov a, key_head
+	add a, #key_queue
+	mov R0, a
+	mov @R0, AR1
+	mov a, key_head
+	inc a
+	anl a, #(KEY_QUEUE_SIZE-1)
+	cjne a, key_tail, Key_Post_Room
+	sjmp Key_Post_Full
+Key_Post_Room:
+	mov key_head, a
+Key_Post_Full:
+	pop acc
+Key_Post_Next:
+	inc R1
+	sjmp Key_Post_Loop
+Key_Post_Done:
+	ret
 
+; Takes the oldest event from key_queue into A and clears the carry.  Sets the carry if
+; there is none.
+Key_Get:
+	mov a, key_tail
+	cjne a, key_head, Key_Get_Some
+	setb c
+	ret
+Key_Get_Some:
+	add a, #key_queue
+	mov R0, a
+	mov b, @R0
+	mov a, key_tail
+	inc a
+	anl a, #(KEY_QUEUE_SIZE-1)
+	mov key_tail, a
+	mov a, b
+	clr c
+	ret
+
+; Does what the button in event A asks for.  A repeat does the same as a press.
+Key_Handle:
+	anl a, #0x7f
+	cjne a, #KEY_TIME_SEC, Key_Handle_1
+	ljmp time_sec_pressed
+Key_Handle_1:
+	cjne a, #KEY_TIME_MIN, Key_Handle_2
+	ljmp time_min_pressed
+Key_Handle_2:
+	cjne a, #KEY_TIME_HOUR, Key_Handle_3
+	ljmp time_hour_pressed
+Key_Handle_3:
+	cjne a, #KEY_SET_SEC, Key_Handle_4
+	ljmp set_sec_pressed
+Key_Handle_4:
+	cjne a, #KEY_SET_MIN, Key_Handle_5
+	ljmp set_min_pressed
+Key_Handle_5:
+	cjne a, #KEY_SET_HOUR, Key_Handle_6
+	ljmp set_hour_pressed
+Key_Handle_6:
+	ret
+
+;---------------------------------;
+; The buzzer is driven by PWM2 at ;
+; BUZZER_RATE with 50% duty.  The ;
+; PWM runs all the time; the      ;
+; alarm just connects it to the   ;
+; SOUND_OUT pin or not.           ;
+;---------------------------------;
+Buzzer_Init:
+	mov PWMCON1, #0x00 ; Edge aligned, independent channels, PWM clock = sysclk/1
+	mov PWMPH, #high(BUZZER_PERIOD-1)
+	mov PWMPL, #low(BUZZER_PERIOD-1)
+	mov PWM2H, #high(BUZZER_PERIOD/2)
+	mov PWM2L, #low(BUZZER_PERIOD/2)
+	orl PWMCON0, #0b11000000 ; PWMRUN=1, LOAD=1: start with the new period and duty
+	clr SOUND_OUT
+	ret
+
+; PIOCON1, which selects PWM2 or the port for P0.5, is in SFR page 1.  Changing pages
+; needs the timed access sequence, which no interrupt may break.
+Buzzer_On:
+	clr EA
+	mov TA, #0xAA
+	mov TA, #0x55
+	orl SFRS, #0x01 ; SFR page 1
+	orl PIOCON1, #0b00000100 ; P0.5 is PWM2
+	mov TA, #0xAA
+	mov TA, #0x55
+	anl SFRS, #0xFE ; SFR page 0
+	setb EA
+	ret
+
+Buzzer_Off:
+	clr EA
+	mov TA, #0xAA
+	mov TA, #0x55
+	orl SFRS, #0x01 ; SFR page 1
+	anl PIOCON1, #0b11111011 ; P0.5 is a port pin again...
+	mov TA, #0xAA
+	mov TA, #0x55
+	anl SFRS, #0xFE ; SFR page 0
+	setb EA
+	clr SOUND_OUT ; ...and stays low
+	ret
 
 ;-----------------------------------------------------------------------------------------------
 
@@ -196,16 +402,15 @@ reset_var:
 ;---------------------------------;
 Timer2_Init:
 	mov T2CON, #0 ; Stop timer/counter.  Autoreload mode.
-	mov TH2, #high(TIMER2_RELOAD)
-	mov TL2, #low(TIMER2_RELOAD)
+	mov TH2, #high(0x10000-TICK_COUNTS)
+	mov TL2, #low(0x10000-TICK_COUNTS)
 	; Set the reload value
-	orl T2MOD, #0x80 ; Enable timer 2 autoreload
-	mov RCMP2H, #high(TIMER2_RELOAD)
-	mov RCMP2L, #low(TIMER2_RELOAD)
-	; Init One millisecond interrupt counter.  It is a 16-bit variable made with two 8-bit parts
+	orl T2MOD, #0b11110000 ; Enable timer 2 autoreload, clock is sysclk/512
+	mov RCMP2H, #high(0x10000-TICK_COUNTS)
+	mov RCMP2L, #low(0x10000-TICK_COUNTS)
 	clr a
-	mov Count1ms+0, a
-	mov Count1ms+1, a
+	mov Tick_Frac+0, a
+	mov Tick_Frac+1, a
 	; Enable the timer and interrupts
 	orl EIE, #0x80 ; Enable timer 2 interrupt ET2=1
     setb TR2  ; Enable timer 2
@@ -218,96 +423,110 @@ Timer2_Init:
 	
 Timer2_ISR:
 	clr TF2  ; Timer 2 doesn't clear TF2 automatically. Do it in the ISR.  It is bit addressable.
-	cpl P0.4 ; To check the interrupt rate with oscilloscope. It must be precisely a 1 ms pulse.
 	
-	; The two registers used in the ISR must be saved in the stack
+	; The three registers used in the ISR must be saved in the stack
 	push acc
 	push psw
+	push b
 	
-	; Increment the 16-bit one mili second counter
-	inc Count1ms+0    ; Increment the low 8-bits first
-	mov a, Count1ms+0 ; If the low 8-bits overflow, then increment high 8-bits
-	jnz Inc_Done
-	inc Count1ms+1
-
-Inc_Done:
-	; Check if half second has passed
-	mov a, Count1ms+0
-	cjne a, #low(200), Timer2_ISR_done ; Warning: this instruction changes the carry flag!
-	mov a, Count1ms+1
-	cjne a, #high(200), Timer2_ISR_done
-	
-	; 500 milliseconds have passed.  Set a flag so the main program knows
 	setb half_seconds_flag ; Let the main program know half second had passed
-	cpl TR0 ; Enable/disable timer/counter 0. This line creates a beep-silence-beep-silence sound.
-	; Reset to zero the milli-seconds counter, it is a 16-bit variable
-	clr a
-	mov Count1ms+0, a
-	mov Count1ms+1, a
+	
+	; Length of the next period.  The reload registers are only used at the next overflow.
+	mov RCMP2H, #high(0x10000-TICK_COUNTS)
+	mov RCMP2L, #low(0x10000-TICK_COUNTS)
+	mov a, Tick_Frac+0
+	add a, #low(TICK_REM)
+	mov Tick_Frac+0, a
+	mov a, Tick_Frac+1
+	addc a, #high(TICK_REM)
+	mov Tick_Frac+1, a
+	clr c
+	mov a, Tick_Frac+0
+	subb a, #low(TICK_DEN)
+	mov b, a
+	mov a, Tick_Frac+1
+	subb a, #high(TICK_DEN)
+	jc Timer2_ISR_done ; Less than a whole count so far
+	mov Tick_Frac+1, a
+	mov Tick_Frac+0, b
+	mov RCMP2H, #high(0x10000-TICK_COUNTS-1)
+	mov RCMP2L, #low(0x10000-TICK_COUNTS-1)
 
-  ;jnb - Jump if Bit Not Set:
-  ;-----------------------------------------------------------------------------------------------
-	jnb Time_Sec_Button, time_sec_pressed
-	jnb Time_Min_Button, time_min_pressed
-	jnb Time_Hour_Button, time_hour_pressed
+Timer2_ISR_done:
+	pop b
+	pop psw
+	pop acc
+	reti
 
-    jnb Set_Sec_Button, set_sec_pressed
-	jnb Set_Min_Button, set_min_pressed
-	jnb Set_Hour_Button,set_pre_hour_pressed              
+;---------------------------------;
+; Clock and alarm update.  Called ;
+; from the main loop each time    ;
+; Timer2_ISR sets                 ;
+; half_seconds_flag, so the ISR   ;
+; stays short.                    ;
+;---------------------------------;
+Clock_Tick:
+	cpl beep_var ; The alarm beeps on every other tick
 
-	; Increment the BCD counter
+	; Increment the BCD counter every other tick: once a second
+	cpl half_sec_var
+	jb half_sec_var, Clock_Tick_done
 	mov a, time_sec_counter
 	add a, #0x01
-	sjmp Timer2_ISR_da_sec
+	sjmp Clock_da_sec
 	;-----------------------------------------------------------------------------------------------
 time_sec_pressed:
 	mov a, time_sec_counter
 	add a, #1
-	sjmp Timer2_ISR_da_sec
+	sjmp Clock_da_sec
 	
 time_min_pressed:
 	mov a, time_min_counter
 	add a, #1
-	sjmp Timer2_ISR_da_min
+	sjmp Clock_da_min
 	
 
 time_hour_pressed:
 	mov a, time_hour_counter
     add a, #1
-	sjmp Timer2_ISR_da_hour
+	sjmp Clock_da_hour
 
-Timer2_ISR_da_sec:
+Clock_da_sec:
 	da a 
 	mov time_sec_counter, a
+	setb dirty_time_sec
 	mov a, time_sec_counter
-	cjne a, #0x60, Timer2_ISR_done
+	cjne a, #0x60, Clock_Tick_done
 	clr a 
 	mov time_sec_counter, a
 	mov a, time_min_counter
 	add a, #1
 	mov time_min_counter, a
 
-Timer2_ISR_da_min:
+Clock_da_min:
 	da a
 	mov time_min_counter, a 
+	setb dirty_time_min
 	mov a, time_min_counter
-	cjne a, #0x60, Timer2_ISR_done
+	cjne a, #0x60, Clock_Tick_done
 	clr a 
 	mov time_min_counter, a
 	mov a, time_hour_counter
 	add a, #1
 	mov time_hour_counter, a 
 
-Timer2_ISR_da_hour:
+Clock_da_hour:
 	da a
 	mov time_hour_counter, a 
+	setb dirty_time_hour
 	mov a, time_hour_counter
-	cjne a, #0x12, Timer2_ISR_done
+	cjne a, #0x12, Clock_Tick_done
 	clr a 
 	mov time_hour_counter, a 
 	cpl AP_time_var
+	setb dirty_time_AP
 
-Timer2_ISR_done:
+Clock_Tick_done:
 	mov a, time_sec_counter
 	cjne a, set_sec_counter, sec_not_same
 	setb set_sec_var
@@ -328,46 +547,60 @@ hour_not_same:
 	setb set_AP_var
 
 done:
-	pop psw
-	pop acc
-	reti
+	; The alarm goes off when all four match at the same time, and then keeps going
+	jnb set_AP_var, reset_var
+	jnb set_sec_var, reset_var
+	jnb set_min_var, reset_var
+	jnb set_hour_var, reset_var
+	jb beep_var, done_beep ; Buzzer_Off is too far for a short jump
+	ljmp Buzzer_Off ; Jumps to the routine, which returns for us
+done_beep:
+	ljmp Buzzer_On
 
-set_pre_hour_pressed:
-	sjmp set_hour_pressed
+reset_var:
+	clr set_AP_var
+	clr set_sec_var
+	clr set_min_var
+	clr set_hour_var		
+	ljmp Buzzer_Off
 
 set_sec_pressed:
 	mov a, set_sec_counter
 	add a, #1
 	da a 
 	mov set_sec_counter, a 
+	setb dirty_set_sec
     mov a, set_sec_counter
-	cjne a, #0x60, Timer2_ISR_done
+	cjne a, #0x60, Clock_Tick_done
 	clr a 
 	mov set_sec_counter, a 
-	sjmp Timer2_ISR_done
+	sjmp Clock_Tick_done
 
 set_min_pressed:
 	mov a, set_min_counter
 	add a, #1
 	da a 
 	mov set_min_counter, a 
+	setb dirty_set_min
     mov a, set_min_counter
-	cjne a, #0x60, Timer2_ISR_done
+	cjne a, #0x60, Clock_Tick_done
 	clr a 
 	mov set_min_counter, a 
-	sjmp Timer2_ISR_done
+	sjmp Clock_Tick_done
 
 set_hour_pressed:
 	mov a, set_hour_counter
 	add a, #0x01
 	da a 
 	mov set_hour_counter, a 
+	setb dirty_set_hour
     mov a, set_hour_counter
-	cjne a, #0x12, Timer2_ISR_done
+	cjne a, #0x12, Clock_Tick_done
 	clr a
 	mov set_hour_counter, a 
 	cpl AP_set_var
-	sjmp Timer2_ISR_done
+	setb dirty_set_AP
+	sjmp Clock_Tick_done
 
 ;---------------------------------;
 ; Main program. Includes hardware ;
@@ -385,6 +618,7 @@ main:
     mov P3M2, #0x00
           
     lcall Timer0_Init
+    lcall Buzzer_Init
     lcall Timer2_Init
     setb EA   ; Enable Global interrupts
     lcall LCD_4BIT
@@ -399,7 +633,7 @@ main:
 		;---------------------------------------------------------------------
 
 
-    setb half_seconds_flag
+    clr half_seconds_flag
 	mov time_sec_counter,  #0x00
 	mov time_min_counter,  #0x00		
 	mov time_hour_counter, #0x00
@@ -417,15 +651,29 @@ main:
 	clr set_min_var
 	clr set_hour_var
 	
+	; Everything needs to be shown the first time
+	setb dirty_time_sec
+	setb dirty_time_min
+	setb dirty_time_hour
+	setb dirty_time_AP
+	setb dirty_set_sec
+	setb dirty_set_min
+	setb dirty_set_hour
+	setb dirty_set_AP
+	
 	; After initialization the program stays in this 'forever' loop
 PM_timecheck:
-  	clr half_seconds_flag ; We clear this flag in the main loop, but it is - in the ISR for timer 2
+	; Only the fields that changed are written to the LCD
+	jnb dirty_time_AP, PM_setcheck
+	clr dirty_time_AP
 	Set_Cursor(1, 15)     ; the place in the LCD where we want the BCD counter value
 	jb AP_time_var, PM_time
 	Send_Constant_String(#AM)
 	mov Time_AP, #0x00
 
 PM_setcheck:
+	jnb dirty_set_AP, main_repeat
+	clr dirty_set_AP
 	Set_Cursor(2,15)
 	jb AP_set_var, PM_set
 	Send_Constant_String(#AM)
@@ -442,20 +690,48 @@ PM_set:
 	mov Set_AP, #0x01
 
 main_repeat:
+	jnb dirty_time_sec, show_time_min
+	clr dirty_time_sec
 	Set_Cursor(1,12)
 	display_BCD(time_sec_counter)
+show_time_min:
+	jnb dirty_time_min, show_time_hour
+	clr dirty_time_min
 	Set_Cursor(1,9)
 	display_BCD(time_min_counter)
+show_time_hour:
+	jnb dirty_time_hour, show_set_sec
+	clr dirty_time_hour
 	Set_Cursor(1,6)
 	display_BCD(time_hour_counter)
 
+show_set_sec:
+	jnb dirty_set_sec, show_set_min
+	clr dirty_set_sec
     Set_Cursor(2,12)
 	display_BCD(set_sec_counter)
+show_set_min:
+	jnb dirty_set_min, show_set_hour
+	clr dirty_set_min
 	Set_Cursor(2,9)
 	display_BCD(set_min_counter)
+show_set_hour:
+	jnb dirty_set_hour, show_done
+	clr dirty_set_hour
 	Set_Cursor(2,6)
 	display_BCD(set_hour_counter)
-
+show_done:
+
+	; Nothing else to do until a button is pressed or Timer2_ISR says the next tick is here
+Wait_Tick:
+	lcall Key_Get
+	jc Wait_No_Key
+	lcall Key_Handle
+	ljmp PM_timecheck ; Show the change
+Wait_No_Key:
+	jnb half_seconds_flag, Wait_Tick
+  	clr half_seconds_flag ; We clear this flag in the main loop, but it is set in the ISR for timer 2
+	lcall Clock_Tick
   ljmp PM_timecheck
 	
 END
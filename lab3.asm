@@ -25,9 +25,41 @@ BAUD              EQU 115200 ; Baud rate of UART in bps
 TIMER1_RELOAD     EQU (0x100-(CLK/(16*BAUD)))
 TIMER0_RELOAD_1MS EQU (0x10000-(CLK/1000))
 
+VCC_mV10          EQU 50300 ; VCC voltage measured, in 1/10000 V
+ADC_FULL          EQU 4095  ; 2^12-1
+ZERO_C_mV10       EQU 27300 ; LM335 output at 0C, in 1/10000 V.  10mV per degree.
+
+; Timer 2 starts an ADC conversion SAMPLE_HZ times a second on each channel, in the
+; background.  Every 2^OVERSAMPLE_BITS conversions the sums become a new reading, so
+; OVERSAMPLE_BITS sets both the rate (7: 2 readings a second) and the noise: each factor
+; of 4 halves the noise and adds a bit of resolution.  Use 4 to 8.
+OVERSAMPLE_BITS   EQU 7
+SAMPLE_HZ         EQU 256
+TIMER2_RELOAD     EQU (0x10000-(CLK/(2*SAMPLE_HZ)))
+
+; Binary telemetry frame: sync byte (0xA5), channel id, sequence number, 32-bit
+; little-endian value and CRC-8 (polynomial 0x07) of the six bytes between the
+; sync byte and the CRC.  Decoded by lab3_graph.py.
+TELEMETRY_SYNC    EQU 0xA5
+TELEMETRY_TEMP    EQU 0x01 ; 1/100 of a degree C
+TELEMETRY_VOLT    EQU 0x02 ; 1/10000 of a volt
+
+; Serial transmit queue used by serial_tx.inc.  The stack starts at 0x80 and grows
+; up, so the queue goes at the top of the indirect RAM.
+TXQ_SIZE          EQU 32
+TXQ_BUF           EQU (0x100-TXQ_SIZE)
+
 ORG 0x0000
 	ljmp main
 
+; Serial port receive/transmit interrupt vector
+ORG 0x0023
+	ljmp Serial_ISR
+
+; Timer/Counter 2 overflow interrupt vector
+ORG 0x002B
+	ljmp Timer2_ISR
+
 ;                     1234567890123456    <- This helps determine the location of the counter
 test_message:     db 'temp: ', 0
 value_message:    db 'volt: ', 0
@@ -50,12 +82,26 @@ x:   ds 4
 y:   ds 4
 bcd: ds 5
 VLED_ADC: ds 2
+tx_seq: ds 1 ; Telemetry frame sequence number
+tx_crc: ds 1
+txq_head: ds 1
+txq_tail: ds 1
+adc_sum_led: ds 3 ; Conversions added up by Timer2_ISR
+adc_sum_sig: ds 3
+adc_out_led: ds 3 ; Last complete sums
+adc_out_sig: ds 3
+adc_count: ds 1
 
 BSEG
 mf: dbit 1
+txq_busy: dbit 1
+adc_chan7: dbit 1 ; Converting channel 7 (else channel 0)
+adc_ready: dbit 1 ; New sums in adc_out_led and adc_out_sig
 
 $NOLIST
 $include(math32.inc)
+$include(serial_tx.inc)
+$include(bcd16.inc)
 $LIST
 
 Init_All:
@@ -112,12 +158,11 @@ waitms:
 	ret
 
 ; We can display a number any way we want.  In this case with
-; four decimal places.
+; two decimal places.
 Display_formated_temp:
 	Set_Cursor(1, 10)
-	Display_BCD(bcd+2)
-	Display_char(#'.')
 	Display_BCD(bcd+1)
+	Display_char(#'.')
 	Display_BCD(bcd+0)
 	;Set_Cursor(1, 10)
 	;Display_char(#'=')
@@ -133,50 +178,289 @@ Display_formated_volt:
 	;Display_char(#'=')
 	ret
 
-Read_ADC:
+Timer2_Init:
+	mov T2CON, #0 ; Stop timer/counter.  Autoreload mode.
+	mov TH2, #high(TIMER2_RELOAD)
+	mov TL2, #low(TIMER2_RELOAD)
+	; Set the reload value
+	orl T2MOD, #0x80 ; Enable timer 2 autoreload
+	mov RCMP2H, #high(TIMER2_RELOAD)
+	mov RCMP2L, #low(TIMER2_RELOAD)
+	clr a
+	mov adc_sum_led+0, a
+	mov adc_sum_led+1, a
+	mov adc_sum_led+2, a
+	mov adc_sum_sig+0, a
+	mov adc_sum_sig+1, a
+	mov adc_sum_sig+2, a
+	mov adc_count, #low(1<<OVERSAMPLE_BITS)
+	clr adc_ready
+	clr adc_chan7
+	anl ADCCON0, #0xF0 ; Select channel 0
 	clr ADCF
-	setb ADCS ;  ADC start trigger signal
-    jnb ADCF, $ ; Wait for conversion complete
-    
-    ; Read the ADC result and store in [R1, R0]
-    mov a, ADCRL
-    anl a, #0x0f
-    mov R0, a
-    mov a, ADCRH   
-    swap a
-    push acc
-    anl a, #0x0f
-    mov R1, a
-    pop acc
-    anl a, #0xf0
-    orl a, R0
-    mov R0, A
+	setb ADCS ; The first conversion
+	; Enable the timer and interrupts
+	orl EIE, #0x80 ; Enable timer 2 interrupt ET2=1
+    setb TR2  ; Enable timer 2
 	ret
+
+; Adds the conversion started last time to its channel's sum and starts the next one, on
+; the other channel, so the conversions happen while the main loop does something else.
+Timer2_ISR:
+	clr TF2  ; Timer 2 doesn't clear TF2 automatically. Do it in the ISR.  It is bit addressable.
+	push acc
+	push psw
+	push b
+	push AR0
 	
-ACCII:
-	send_bcd(bcd+2)
-    send_bcd(bcd+1)
-    send_bcd(bcd+0)
-    
-    ret
-  
-new_line:
-    db '\n', 0
-
-SendString:
-    clr A
-    movc A, @A+DPTR
-    jz SendStringDone
-    lcall putchar
-    inc DPTR
-    sjmp SendString
-SendStringDone:
-    ret
-    
+	; 12-bit result: bits 11 to 4 in ADCRH, bits 3 to 0 in ADCRL
+	mov a, ADCRL
+	anl a, #0x0f
+	mov b, a
+	mov a, ADCRH
+	swap a
+	push acc
+	anl a, #0xf0
+	orl a, b
+	mov R0, #adc_sum_led
+	jnb adc_chan7, Timer2_ISR_Add
+	mov R0, #adc_sum_sig
+Timer2_ISR_Add:
+	add a, @R0
+	mov @R0, a
+	inc R0
+	pop acc
+	anl a, #0x0f
+	addc a, @R0
+	mov @R0, a
+	inc R0
+	clr a
+	addc a, @R0
+	mov @R0, a
+	
+	; Next conversion on the other channel
+	cpl adc_chan7
+	anl ADCCON0, #0xF0 ; Select channel 0
+	jnb adc_chan7, Timer2_ISR_Start
+	orl ADCCON0, #0x07 ; Select channel 7
+Timer2_ISR_Start:
+	clr ADCF
+	setb ADCS
+	
+	; After channel 7, check if we have all the conversions for a reading
+	jb adc_chan7, Timer2_ISR_Done
+	djnz adc_count, Timer2_ISR_Done
+	mov adc_count, #low(1<<OVERSAMPLE_BITS)
+	mov adc_out_led+0, adc_sum_led+0
+	mov adc_out_led+1, adc_sum_led+1
+	mov adc_out_led+2, adc_sum_led+2
+	mov adc_out_sig+0, adc_sum_sig+0
+	mov adc_out_sig+1, adc_sum_sig+1
+	mov adc_out_sig+2, adc_sum_sig+2
+	clr a
+	mov adc_sum_led+0, a
+	mov adc_sum_led+1, a
+	mov adc_sum_led+2, a
+	mov adc_sum_sig+0, a
+	mov adc_sum_sig+1, a
+	mov adc_sum_sig+2, a
+	setb adc_ready
+	
+Timer2_ISR_Done:
+	pop AR0
+	pop b
+	pop psw
+	pop acc
+	reti
+
+; Scales the sum of 2^OVERSAMPLE_BITS conversions at @R0 to 16 bits in [R1, R0]: full
+; scale is 0xFFF0, as if the ADC had 16 bits.
+Decimate:
+	mov x+0, @R0
+	inc R0
+	mov x+1, @R0
+	inc R0
+	mov x+2, @R0
+	mov R2, #(OVERSAMPLE_BITS-4+1)
+	sjmp Decimate_Next
+Decimate_Loop:
+	clr c
+	mov a, x+2
+	rrc a
+	mov x+2, a
+	mov a, x+1
+	rrc a
+	mov x+1, a
+	mov a, x+0
+	rrc a
+	mov x+0, a
+Decimate_Next:
+	djnz R2, Decimate_Loop
+	mov R0, x+0
+	mov R1, x+1
+	ret
+	
+; Voltage at ADC codes 0, 256, 512, ... 4096 in 1/10000 V, low byte first.  Computed by
+; the assembler from VCC_mV10, so changing the calibration only needs the EQU.
+Volt_Table:
+	db low((   0*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((   0*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low(( 256*VCC_mV10+ADC_FULL/2)/ADC_FULL), high(( 256*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low(( 512*VCC_mV10+ADC_FULL/2)/ADC_FULL), high(( 512*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low(( 768*VCC_mV10+ADC_FULL/2)/ADC_FULL), high(( 768*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((1024*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((1024*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((1280*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((1280*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((1536*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((1536*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((1792*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((1792*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((2048*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((2048*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((2304*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((2304*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((2560*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((2560*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((2816*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((2816*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((3072*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((3072*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((3328*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((3328*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((3584*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((3584*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((3840*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((3840*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+	db low((4096*VCC_mV10+ADC_FULL/2)/ADC_FULL), high((4096*VCC_mV10+ADC_FULL/2)/ADC_FULL)
+
+; Converts the 16-bit ADC result in [R1, R0] (from Decimate) to 1/10000 V in x,
+; interpolating between the two table entries around it: the top four bits select the
+; entry and the other twelve are the fraction.  Uses y as scratch.
+ADC_to_Volt:
+	mov dptr, #Volt_Table
+	mov a, R1
+	swap a
+	anl a, #0x0f
+	rl a ; Two bytes per entry
+	mov b, a
+	movc a, @a+dptr ; Entry below the ADC result goes to x
+	mov x+0, a
+	mov a, b
+	inc a
+	movc a, @a+dptr
+	mov x+1, a
+	mov a, b ; Slope: next entry minus this one, to y
+	add a, #3
+	movc a, @a+dptr
+	mov y+1, a
+	mov a, b
+	add a, #2
+	movc a, @a+dptr
+	clr c
+	subb a, x+0
+	mov y+0, a
+	mov a, y+1 ; The borrow must reach the high byte: no 'add' in between
+	subb a, x+1
+	mov y+1, a
+	; [y+3, y+2] = (slope*fraction)/256.  The product is less than 2^24.
+	mov a, y+0
+	mov b, R0
+	mul ab
+	mov y+2, b
+	mov a, y+1
+	mov b, R0
+	mul ab
+	add a, y+2
+	mov y+2, a
+	clr a
+	addc a, b
+	mov y+3, a
+	mov a, R1
+	anl a, #0x0f
+	mov b, y+0
+	mul ab
+	add a, y+2
+	mov y+2, a
+	mov a, b
+	addc a, y+3
+	mov y+3, a
+	mov a, R1
+	anl a, #0x0f
+	mov b, y+1
+	mul ab
+	add a, y+3
+	mov y+3, a
+	; x = x + (slope*fraction)/4096
+	mov a, y+2
+	swap a
+	anl a, #0x0f
+	mov y+2, a
+	mov a, y+3
+	swap a
+	mov b, a
+	anl a, #0xf0
+	orl a, y+2
+	add a, x+0
+	mov x+0, a
+	mov a, b
+	anl a, #0x0f
+	addc a, x+1
+	mov x+1, a
+	mov x+2, #0
+	mov x+3, #0
+	ret
+
+; Converts x from 1/10000 V to 1/100 C: at 10mV per degree that is just the voltage above
+; ZERO_C_mV10.  Below 0C gives 0.
+Volt_to_Temp:
+	clr c
+	mov a, x+0
+	subb a, #low(ZERO_C_mV10)
+	mov x+0, a
+	mov a, x+1
+	subb a, #high(ZERO_C_mV10)
+	mov x+1, a
+	jnc Volt_to_Temp_Done
+	mov x+0, #0
+	mov x+1, #0
+Volt_to_Temp_Done:
+	ret
+
+; Sends the accumulator and adds it to the CRC in tx_crc
+Send_CRC_Byte:
+	push acc
+	lcall Serial_Put
+	pop acc
+	xrl a, tx_crc
+	mov b, #8
+Send_CRC_Bit:
+	clr c
+	rlc a
+	jnc Send_CRC_Next
+	xrl a, #0x07
+Send_CRC_Next:
+	djnz b, Send_CRC_Bit
+	mov tx_crc, a
+	ret
+
+; Sends the 32-bit number in x as a telemetry frame.  The channel id is in the accumulator.
+Send_Frame:
+	push acc
+	mov tx_crc, #0
+	mov a, #TELEMETRY_SYNC
+	lcall Serial_Put
+	pop acc
+	lcall Send_CRC_Byte
+	mov a, tx_seq
+	inc tx_seq
+	lcall Send_CRC_Byte
+	mov a, x+0
+	lcall Send_CRC_Byte
+	mov a, x+1
+	lcall Send_CRC_Byte
+	mov a, x+2
+	lcall Send_CRC_Byte
+	mov a, x+3
+	lcall Send_CRC_Byte
+	mov a, tx_crc
+	lcall Serial_Put
+	ret
+
 main:
 	mov sp, #0x7f
 	lcall Init_All
     lcall LCD_4BIT
+    lcall Serial_Init
+    mov tx_seq, #0
+    lcall Timer2_Init
     
     ; initial messages in LCD
 	Set_Cursor(1, 1)
@@ -185,52 +469,36 @@ main:
     Send_Constant_String(#value_message)
     
 Forever:
+	; Timer2_ISR does the conversions.  Wait for the next reading.
+	jnb adc_ready, $
+	clr adc_ready
 
-	; Read the 2.08V LED voltage connected to AIN0 on pin 6
-	anl ADCCON0, #0xF0
-	orl ADCCON0, #0x00 ; Select channel 0
-
-	lcall Read_ADC
+	; The 2.08V LED voltage connected to AIN0 on pin 6
+	mov R0, #adc_out_led
+	lcall Decimate
 	; Save result for later use
 	mov VLED_ADC+0, R0
 	mov VLED_ADC+1, R1
 
-	; Read the signal connected to AIN7
-	anl ADCCON0, #0xF0
-	orl ADCCON0, #0x07 ; Select channel 7
-	lcall Read_ADC
+	; The signal connected to AIN7
+	mov R0, #adc_out_sig
+	lcall Decimate
     
     ; Convert to voltage
-	mov x+0, R0
-	mov x+1, R1
-	; Pad other bits with zero
-	mov x+2, #0
-	mov x+3, #0
-	Load_y(50300) ; VCC voltage measured
-	lcall mul32
-	Load_y(4095) ; 2^12-1
-	lcall div32
+	lcall ADC_to_Volt
 
-	lcall hex2bcd
+	lcall Bin16_to_BCD
     lcall Display_formated_volt
+    mov a, #TELEMETRY_VOLT
+    lcall Send_Frame
 
-    Load_y(27300)
-    lcall sub32
-    Load_y(100)
-    lcall mul32
+    lcall Volt_to_Temp
 
     ; Convert to BCD and display
-    lcall hex2bcd
+    lcall Bin16_to_BCD
     lcall Display_formated_temp
-    lcall ACCII
-    mov DPTR, #new_line
-    lcall SendString
-    
-    ; Wait 500 ms between conversions
-    mov R2, #250
-    lcall waitms
-    mov R2, #250
-    lcall waitms
+    mov a, #TELEMETRY_TEMP
+    lcall Send_Frame
     
     ljmp Forever
 
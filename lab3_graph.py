@@ -1,87 +1,359 @@
 import numpy as np
 import matplotlib.pyplot as plt
 import matplotlib.animation as animation
-import sys, time, math
+import os, sys, time, math, threading, argparse
 import serial
-# configure the serial port
-ser = serial.Serial(
-  port='COM3',
-  baudrate=115200,
-  parity=serial.PARITY_NONE,
-  stopbits=serial.STOPBITS_TWO,
-  bytesize=serial.EIGHTBITS
-)
-ser.isOpen()
+
+# python lab3_graph.py                          plot the board
+# python lab3_graph.py --record run.bin         plot the board and save the frames
+# python lab3_graph.py --replay run.bin --speed 10 [--start 3600]
+#                                               plot a saved run (speed: 1, 10 or max)
+parser = argparse.ArgumentParser()
+parser.add_argument('--record', metavar='FILE')
+parser.add_argument('--replay', metavar='FILE')
+parser.add_argument('--speed', default='1', choices=['1', '10', 'max'])
+parser.add_argument('--start', type=float, default=0, help='seconds into the replay')
+args = parser.parse_args()
+
+if args.replay is None:
+    # configure the serial port
+    ser = serial.Serial(
+      port='COM3',
+      baudrate=115200,
+      parity=serial.PARITY_NONE,
+      stopbits=serial.STOPBITS_TWO,
+      bytesize=serial.EIGHTBITS,
+      timeout=0.1
+    )
+    ser.isOpen()
 #strin = ser.readline()
 #str_data = strin.decode('utf-8').strip()
   
   
-xsize=100
-   
-#test cases
-#print(int(str_data[1:len(str_data)-2]));
-#print(float(str_data[:len(str_data)])/100);
-
-for x in range(5):
-    strin = ser.readline()
-    yh = strin.decode('utf-8').strip()
-    yh = int(yh[1:len(yh)-2])
-    yf = strin.decode('utf-8').strip()
-    yf = float(yf[:len(yf)])/100
-    print(yh,'\t',yf)
-##########################################    
-    
-def data_gen():
-    t = data_gen.t
+xsize=1000        # Samples shown
+RING_SIZE=1<<16   # Samples kept by the reader thread
+FPS=30            # Plot updates per second
+
+##########################################
+# Binary telemetry frames sent by lab3.asm, lab4.c and lab6.c:
+#   0xA5, channel id, sequence number, 32-bit little-endian signed value,
+#   CRC-8 (polynomial 0x07, initial value 0) of the six bytes between sync and CRC.
+SYNC = 0xA5
+FRAME_LEN = 8
+
+# Channel id: (name, scale to engineering units)
+CHANNELS = {
+    0x01: ('Temperature (C)', 1e-2),   # lab3.asm
+    0x02: ('Voltage (V)', 1e-4),       # lab3.asm
+    0x10: ('Frequency (Hz)', 1e-2),    # lab4.c
+    0x11: ('Capacitance (pF)', 1),     # lab4.c
+    0x20: ('Period (ns)', 1),          # lab6.c
+    0x21: ('Capacitance (pF)', 1),     # lab6.c
+}
+PLOT_CHANNEL = 0x01
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+CRC_TABLE = np.array([crc8([i]) for i in range(256)], dtype=np.uint8)
+
+class FrameDecoder:
+    """Finds frames in a byte stream, a whole chunk at a time with numpy.  Bytes that
+    don't start a frame with a good CRC are skipped, so the decoder resynchronizes by
+    itself.  Gaps in the sequence numbers are counted as dropped frames."""
+    def __init__(self):
+        self.buf = np.zeros(0, dtype=np.uint8)
+        self.last_seq = None
+        self.dropped = 0
+        self.bad = 0
+
+    def feed(self, data):
+        """Returns the (channel, seq, value) arrays of the frames completed by 'data'."""
+        buf = np.concatenate((self.buf, np.frombuffer(data, dtype=np.uint8)))
+        n = len(buf) - FRAME_LEN + 1 # Positions where a whole frame fits
+        if n <= 0:
+            self.buf = buf
+            return np.zeros(0, np.uint8), np.zeros(0, np.uint8), np.zeros(0, np.int32)
+        # Check the CRC of every sync byte candidate at once
+        start = np.flatnonzero(buf[:n] == SYNC)
+        crc = np.zeros(len(start), dtype=np.uint8)
+        for k in range(1, 7):
+            crc = CRC_TABLE[crc ^ buf[start + k]]
+        start = start[crc == buf[start + 7]]
+        # A good CRC inside another frame is rare, but drop any frame that overlaps the last one kept
+        if len(start) > 1 and np.any(np.diff(start) < FRAME_LEN):
+            keep = [start[0]]
+            for i in start[1:]:
+                if i >= keep[-1] + FRAME_LEN:
+                    keep.append(i)
+            start = np.array(keep)
+        end = max(n, start[-1] + FRAME_LEN) if len(start) else n
+        self.bad += end - FRAME_LEN*len(start)
+        self.buf = buf[end:]
+
+        channel = buf[start + 1]
+        seq = buf[start + 2]
+        value = buf[start[:, None] + np.arange(3, 7)].copy().view('<i4').ravel()
+        if len(seq):
+            s = seq.astype(np.int32)
+            prev = np.concatenate(([s[0] - 1 if self.last_seq is None else self.last_seq], s[:-1]))
+            self.dropped += int(np.sum((s - prev - 1) & 0xff))
+            self.last_seq = int(seq[-1])
+        return channel, seq, value
+
+class SampleRing:
+    """Fixed size ring buffer of the latest samples, shared by the reader thread and the plot."""
+    def __init__(self, size):
+        self.y = np.zeros(size)
+        self.count = 0 # Samples ever written
+        self.lock = threading.Lock()
+
+    def append(self, y):
+        size = len(self.y)
+        y = y[-size:]
+        with self.lock:
+            i = (self.count + np.arange(len(y))) % size
+            self.y[i] = y
+            self.count += len(y)
+
+    def latest(self, n):
+        """Returns a copy of the last 'n' samples (fewer at the start), oldest first."""
+        with self.lock:
+            n = min(n, self.count, len(self.y))
+            i = (self.count - n + np.arange(n)) % len(self.y)
+            return self.y[i].copy(), self.count
+
+class GrowArray:
+    """numpy array that can be appended to, doubling its storage when full."""
+    def __init__(self, dtype=np.float32):
+        self.data = np.zeros(1024, dtype)
+        self.n = 0
+
+    def extend(self, y):
+        if self.n + len(y) > len(self.data):
+            data = np.zeros(max(2*len(self.data), self.n + len(y)), self.data.dtype)
+            data[:self.n] = self.data[:self.n]
+            self.data = data
+        self.data[self.n:self.n + len(y)] = y
+        self.n += len(y)
+
+    def view(self):
+        return self.data[:self.n]
+
+class MinMaxPyramid:
+    """Keeps every sample, plus the min and max of each block of 2, 4, 8... samples, so any
+    part of a long run can be drawn with about one min/max pair per pixel without hiding
+    short spikes."""
+    def __init__(self):
+        self.raw = GrowArray()
+        self.levels = [] # levels[k-1] = (min, max) of blocks of 2**k samples
+        self.lock = threading.Lock()
+
+    def __len__(self):
+        return self.raw.n
+
+    def append(self, y):
+        with self.lock:
+            self.raw.extend(y)
+            lo = hi = self.raw.view()
+            k = 0
+            while len(lo) >= 2:
+                if k == len(self.levels):
+                    self.levels.append((GrowArray(), GrowArray()))
+                lo_k, hi_k = self.levels[k]
+                have, can = lo_k.n, len(lo)//2
+                if can > have: # Blocks completed by the new samples
+                    lo_k.extend(lo[2*have:2*can].reshape(-1, 2).min(axis=1))
+                    hi_k.extend(hi[2*have:2*can].reshape(-1, 2).max(axis=1))
+                lo, hi = lo_k.view(), hi_k.view()
+                k += 1
+
+    def query(self, x0, x1, npix):
+        """Returns x, y to plot samples x0 to x1 with at most about 'npix' min/max pairs."""
+        with self.lock:
+            n = self.raw.n
+            x0 = max(0, int(x0))
+            x1 = min(n, int(math.ceil(x1)) + 1)
+            if x1 <= x0:
+                return np.zeros(0), np.zeros(0)
+            k = 0
+            while k < len(self.levels) and ((x1 - x0) >> k) > npix:
+                k += 1
+            if k == 0:
+                return np.arange(x0, x1), self.raw.data[x0:x1].copy()
+            lo, hi = self.levels[k-1][0].view(), self.levels[k-1][1].view()
+            i0, i1 = x0 >> k, min((x1 + (1 << k) - 1) >> k, len(lo))
+            lo, hi = lo[i0:i1], hi[i0:i1]
+            if i1 << k < x1: # The newest samples aren't in a whole block yet
+                tail = self.raw.data[i1 << k:x1]
+                lo, hi = np.append(lo, tail.min()), np.append(hi, tail.max())
+        x = (np.arange(i0, i0 + len(lo)) << k) + (1 << (k - 1))
+        return np.repeat(x, 2), np.column_stack((lo, hi)).ravel()
+
+##########################################
+# Capture files: a 16 byte header followed by 16 byte records, so a whole file can be
+# opened with np.memmap.  Every INDEX_EVERY frames the recorder also writes an index
+# record (channel INDEX_CHANNEL) holding the number of records before it, so a replay
+# can start anywhere in a long run without reading all of it.
+CAPTURE_MAGIC = b'ELEC291 CAPTURE1'
+RECORD = np.dtype([('t', '<f8'), ('value', '<i4'), ('channel', 'u1'), ('seq', 'u1'), ('pad', '<u2')])
+INDEX_CHANNEL = 0xff
+INDEX_EVERY = 4096
+
+class Recorder:
+    """Appends decoded frames to a capture file, with the time they were received."""
+    def __init__(self, path):
+        self.file = open(path, 'wb')
+        self.file.write(CAPTURE_MAGIC)
+        self.records = 0
+        self.next_index = 0
+        self.t0 = time.monotonic()
+
+    def write(self, channel, seq, value):
+        t = time.monotonic() - self.t0
+        while len(channel):
+            if self.records >= self.next_index:
+                self.file.write(np.array([(t, self.records, INDEX_CHANNEL, 0, 0)], RECORD).tobytes())
+                self.records += 1
+                self.next_index = self.records + INDEX_EVERY
+            n = min(len(channel), self.next_index - self.records)
+            rec = np.zeros(n, RECORD)
+            rec['t'], rec['channel'], rec['seq'], rec['value'] = t, channel[:n], seq[:n], value[:n]
+            self.file.write(rec.tobytes())
+            self.records += n
+            channel, seq, value = channel[n:], seq[n:], value[n:]
+        self.file.flush()
+
+def open_capture(path):
+    """Maps the whole records of a capture file.  A recording that was cut off can end in
+    part of a record, which is left out."""
+    with open(path, 'rb') as f:
+        if f.read(len(CAPTURE_MAGIC)) != CAPTURE_MAGIC:
+            sys.exit(path + ' is not a capture file')
+    count = (os.path.getsize(path) - len(CAPTURE_MAGIC))//RECORD.itemsize
+    if count == 0: # np.memmap can't map an empty file
+        return np.zeros(0, RECORD)
+    return np.memmap(path, dtype=RECORD, mode='r', offset=len(CAPTURE_MAGIC), shape=(count,))
+
+def seek_capture(rec, t):
+    """Returns the number of the first record at or after 't' seconds, using the index records."""
+    first = 0
+    i = 0
+    while i < len(rec) and rec[i]['channel'] == INDEX_CHANNEL and rec[i]['t'] <= t:
+        first = i
+        i = int(rec[i]['value']) + INDEX_EVERY + 1 # Where the next index record is
+    return first + int(np.searchsorted(rec['t'][first:i], t))
+
+decoder = FrameDecoder()
+samples = SampleRing(RING_SIZE)
+history = MinMaxPyramid()
+recorder = Recorder(args.record) if args.record else None
+
+def store(channel, seq, value):
+    if recorder:
+        recorder.write(channel, seq, value)
+    y = value[channel == PLOT_CHANNEL]*CHANNELS[PLOT_CHANNEL][1]
+    samples.append(y)
+    history.append(y)
+
+def reader():
+    # Runs in its own thread: takes whatever the serial port has, so the rate of the
+    # samples doesn't depend on the rate of the plot.
     while True:
-       t+=1
-       strin = ser.readline()
-       strin = strin.decode('utf-8').strip()
-       val = int(strin)/10000
-       yield t, val
-
-def run(data):
-    # update the data
-    t,y = data
-    if t>-1:
-        xdata.append(t)
-        ydata.append(y)
-        if t>xsize: # Scroll to the left.
-            ax.set_xlim(t-xsize, t)
-        line.set_data(xdata, ydata)
-        
-        #error = 0.1  # Adjust this with your actual error
-        #ax.errorbar(t, y, yerr=error, fmt='ro', markersize=5)
-        
-        if hasattr(run, 'text_label'):
-            run.text_label.set_text('')
-        
-        run.text_label = ax.text(t, ax.get_ylim()[1], f'{y:.2f}', fontsize=8, ha='left', va='bottom', color='black')
-        #run.text_label.set_text(f'{y:.2f}')
-
-    return line,
+        data = ser.read(max(1, ser.in_waiting))
+        if data:
+            store(*decoder.feed(data))
+
+def replayer():
+    # Like reader(), but takes the frames from a capture file at 1x, 10x or full speed.
+    rec = open_capture(args.replay)
+    i = seek_capture(rec, args.start)
+    speed = None if args.speed == 'max' else float(args.speed)
+    t_start, wall_start, n = args.start, time.monotonic(), 0
+    while i < len(rec):
+        if speed:
+            t = t_start + (time.monotonic() - wall_start)*speed
+            end = i + int(np.searchsorted(rec['t'][i:i + RING_SIZE], t, side='right'))
+            if end == i:
+                time.sleep(0.005)
+                continue
+        else:
+            end = min(i + RING_SIZE, len(rec))
+        chunk = rec[i:end]
+        chunk = chunk[chunk['channel'] != INDEX_CHANNEL]
+        store(chunk['channel'], chunk['seq'], chunk['value'])
+        n += len(chunk)
+        i = end
+    wall = time.monotonic() - wall_start
+    print(f'Replayed {n} frames in {wall:.2f}s ({n/max(wall, 1e-9):.0f} frames/s)')
+
+def init():
+    line.set_data([], [])
+    label.set_text('')
+    return line, label
+
+def run(frame):
+    # Redraws the last xsize samples at a fixed frame rate, however many arrived
+    y, count = samples.latest(xsize)
+    line.set_data(np.arange(1 - len(y), 1), y) # Newest sample at x=0, so the axes never move
+    if len(y):
+        label.set_text(f'{y[-1]:.2f}  ({decoder.dropped} lost)')
+    return line, label
+
+def update_history(ax=None):
+    # Redraws the whole run plot at one min/max pair per pixel for the current zoom.
+    # Called once a second and whenever the view is zoomed or panned.
+    n = len(history)
+    x0, x1 = ax2.get_xlim()
+    if x1 >= update_history.end - 1 and n > update_history.end: # Keep following the newest sample
+        update_history.end = n
+        ax2.set_xlim(x0, n) # Calls us back through 'xlim_changed'
+        fig.canvas.draw_idle()
+        return
+    x, y = history.query(x0, x1, int(ax2.bbox.width))
+    line2.set_data(x, y)
+    if ax is None:
+        fig.canvas.draw_idle()
+
+update_history.end = 1
 
 def on_close_figure(event):
     sys.exit(0)
 
-data_gen.t = -1
 fig = plt.figure()
 fig.canvas.mpl_connect('close_event', on_close_figure)
-ax = fig.add_subplot(111)
+ax = fig.add_subplot(211)
 line, = ax.plot([], [], lw=2)
+label = ax.text(0.99, 0.98, '', transform=ax.transAxes, fontsize=8, ha='right', va='top', color='black')
 ax.set_ylim(20,30)
-ax.set_xlim(0, xsize)
+ax.set_xlim(-xsize, 0)
 ax.grid()
-xdata, ydata = [], []
 
 ax.set_title('Temp vs time')
-ax.set_xlabel('Time-axis ')
+ax.set_xlabel('Samples ago')
 ax.set_ylabel('Temp-axis')
 ax.grid(True)
 
+# The whole run.  Use the toolbar to zoom in.
+ax2 = fig.add_subplot(212)
+line2, = ax2.plot([], [], lw=1)
+ax2.set_ylim(20,30)
+ax2.set_xlim(0, 1)
+ax2.set_xlabel('Sample')
+ax2.set_ylabel('Temp-axis')
+ax2.grid(True)
+ax2.callbacks.connect('xlim_changed', update_history)
+fig.tight_layout()
+history_timer = fig.canvas.new_timer(interval=1000)
+history_timer.add_callback(update_history)
+history_timer.start()
 
-ani = animation.FuncAnimation(fig, run, data_gen, blit=False, interval=100, repeat=False)
+threading.Thread(target=replayer if args.replay else reader, daemon=True).start()
+ani = animation.FuncAnimation(fig, run, init_func=init, blit=True, interval=1000/FPS,
+                              cache_frame_data=False)
 plt.show()
-
-# Important: Although blit=True makes graphing faster, we need blit=False to prevent
-# spurious lines to appear when resizing the stripchart.
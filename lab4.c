@@ -16,6 +16,8 @@
 #define LCD_D7 P1_0
 #define CHARS_PER_LINE 16
 
+#define BINARY_TELEMETRY 1 // 1: send binary frames (decoded by lab3_graph.py). 0: send text.
+
 char _c51_external_startup (void)
 {
 	// Disable Watchdog with 2-byte key sequence
@@ -82,34 +84,152 @@ char _c51_external_startup (void)
 	return 0;
 }
 
-unsigned char overflow_count;
+#define TIMEBASE (SYSCLK/12L) // Timer 2 ticks per second.  All frequency readings are referred to it.
+#define FREQ_RESOLUTION 4000L // Counts (gated) or timebase ticks (reciprocal) per reading: 1 part in 4000
+#define FREQ_PROBE_TICKS (TIMEBASE/100L) // 10 ms probe gate used to estimate the frequency
+#define FREQ_MAX_PERIODS 256 // Timer 0 in 8-bit auto-reload mode counts at most 256 edges
+#define FREQ_TIMEOUT_TICKS (TIMEBASE*2L) // Give up after 2 s without an edge (below 0.5 Hz)
 
-void Timer3us(unsigned char us)
+volatile unsigned int overflow_count;    // Timer 0 overflows during a gated count
+volatile unsigned int timebase_overflow; // Timer 2 overflows: the upper 16 bits of the timebase
+volatile unsigned long edge_time[2];     // Timebase at the first and last counted input edge
+volatile unsigned char edge_captures;    // How many entries of edge_time[] the ISR has filled
+volatile bit reciprocal_mode;            // Timer 0 ISR: 0: extend gated count. 1: timestamp edges
+
+// Result of the last reading: 'freq_events' input periods took 'freq_ticks' timebase ticks.
+// The frequency is freq_events*TIMEBASE/freq_ticks.
+unsigned long freq_events;
+unsigned long freq_ticks;
+
+// Timer 3 is the system tick: it runs free at SYSCLK/12 and overflows every millisecond.
+// The ISR counts the milliseconds; the count left in Timer 3 gives the microseconds.
+// Code that has to wait can take a deadline and poll Expired() instead of sleeping.
+#define TICK_COUNTS_PER_US (SYSCLK/12L/1000000L) // Timer 3 counts per microsecond
+#define TICK_COUNTS_PER_MS (SYSCLK/12L/1000L)
+#define TICK_RELOAD (0x10000L-TICK_COUNTS_PER_MS)
+
+volatile unsigned long tick_ms; // Milliseconds since TIMER3_Init()
+
+void TIMER3_Init(void)
 {
-	unsigned char i;               // usec counter
-	
-	// The input for Timer 3 is selected as SYSCLK by setting T3ML (bit 6) of CKCON0:
-	CKCON0|=0b_0100_0000;
-	
-	TMR3RL = (-(SYSCLK)/1000000L); // Set Timer3 to overflow in 1us.
-	TMR3 = TMR3RL;                 // Initialize Timer3 for first overflow
-	
-	TMR3CN0 = 0x04;                 // Sart Timer3 and clear overflow flag
-	for (i = 0; i < us; i++)       // Count <us> overflows
-	{
-		while (!(TMR3CN0 & 0x80));  // Wait for overflow
-		TMR3CN0 &= ~(0x80);         // Clear overflow indicator
-	}
-	TMR3CN0 = 0 ;                   // Stop Timer3 and clear overflow flag
+	TMR3CN0=0x00; // Stop Timer3; Clear TF3H, clock is SYSCLK/12
+	CKCON0&=~0b_0100_0000; // T3ML=0: Timer 3 uses the clock selected in TMR3CN0
+	TMR3RL=TICK_RELOAD;
+	TMR3=TICK_RELOAD;
+	tick_ms=0;
+	EIE1|=0x80; // Enable Timer3 interrupt
+	TMR3CN0=0x04; // Start Timer3
+}
+
+void Timer3_ISR (void) interrupt INTERRUPT_TIMER3
+{
+	TMR3CN0&=~0x80; // Clear TF3H
+	tick_ms++;
+}
+
+// Returns the Timer 3 count, TICK_RELOAD to 0xffff
+unsigned int Timer3_Count(void)
+{
+	unsigned char hi, lo;
+
+	do {
+		hi=TMR3H;
+		lo=TMR3L;
+	} while(hi!=TMR3H); // Read again if the low byte rolled over between the two reads
+	return (hi*0x100)|lo;
+}
+
+// Returns the milliseconds and puts the Timer 3 counts into the current millisecond in 'counts'
+unsigned long Tick_Read(unsigned int * counts)
+{
+	unsigned int t;
+	unsigned long ms;
+
+	EIE1&=~0x80; // Keep the ISR out while tick_ms and Timer 3 are read
+	t=Timer3_Count();
+	ms=tick_ms;
+	if((TMR3CN0&0x80) && (t<(TICK_RELOAD+TICK_COUNTS_PER_MS/2))) ms++; // Overflowed, but the ISR didn't run yet
+	EIE1|=0x80;
+	*counts=t-TICK_RELOAD;
+	return ms;
+}
+
+unsigned long Tick_ms(void)
+{
+	unsigned int counts;
+	return Tick_Read(&counts);
+}
+
+// Wraps every 71 minutes, so only use it for differences
+unsigned long Tick_us(void)
+{
+	unsigned int counts;
+	unsigned long ms;
+
+	ms=Tick_Read(&counts);
+	return ms*1000L+counts/TICK_COUNTS_PER_US;
+}
+
+unsigned long Deadline_ms(unsigned int ms)
+{
+	return Tick_ms()+ms;
+}
+
+// 1 once the deadline has passed.  Works across the wrap of tick_ms.
+bit Expired(unsigned long deadline)
+{
+	return ((long)(Tick_ms()-deadline)>=0);
 }
 
+unsigned long Elapsed_ms(unsigned long since)
+{
+	return Tick_ms()-since;
+}
+
+// Periodic software timers on top of the tick.  SoftTimer_Expired() is true once per period.
+#define SOFT_TIMERS 4
+#define SOFT_TIMER_LCD 0
+#define LCD_REFRESH_MS 250 // The LCD can't show faster changes anyway
 
+xdata unsigned long soft_deadline[SOFT_TIMERS];
+xdata unsigned int soft_period[SOFT_TIMERS];
+
+void SoftTimer_Start(unsigned char n, unsigned int period_ms)
+{
+	soft_period[n]=period_ms;
+	soft_deadline[n]=Deadline_ms(period_ms);
+}
+
+bit SoftTimer_Expired(unsigned char n)
+{
+	if(!Expired(soft_deadline[n])) return 0;
+	soft_deadline[n]+=soft_period[n]; // From the old deadline, so the period doesn't drift...
+	if(Expired(soft_deadline[n])) soft_deadline[n]=Deadline_ms(soft_period[n]); // ...unless it fell a whole period behind
+	return 1;
+}
+
+// Delays <us> micro-seconds by watching Timer 3.  Doesn't need interrupts.
+void Timer3us(unsigned char us)
+{
+	unsigned int start, now, elapsed;
+	unsigned int wait;
+
+	wait=us*TICK_COUNTS_PER_US;
+	start=Timer3_Count();
+	do {
+		now=Timer3_Count();
+		elapsed=now-start;
+		if(now<start) elapsed+=TICK_COUNTS_PER_MS; // Timer 3 reloaded in between
+	} while(elapsed<wait);
+}
+
+// Needs the Timer 3 interrupt, so call it with interrupts enabled
 void waitms (unsigned int ms)
 {
-	unsigned int j;
-	unsigned char k;
-	for(j=0; j<ms; j++)
-		for (k=0; k<4; k++) Timer3us(250);
+	unsigned long start;
+
+	start=Tick_us();
+	while((Tick_us()-start)<(ms*1000L));
 }
 
 void LCD_pulse (void)
@@ -141,7 +261,7 @@ void WriteData (unsigned char x)
 {
 	LCD_RS=1;
 	LCD_byte(x);
-	waitms(2);
+	Timer3us(40); // Data writes take 37us to execute (HD44780 data sheet)
 }
 
 void WriteCommand (unsigned char x)
@@ -151,8 +271,22 @@ void WriteCommand (unsigned char x)
 	waitms(5);
 }
 
+// Shadow copy of what the LCD is showing, so only the cells that change are sent
+xdata char lcd_shadow[2][CHARS_PER_LINE];
+unsigned char lcd_cursor; // DDRAM address of the LCD cursor
+
+void LCD_goto (unsigned char addr)
+{
+	LCD_RS=0;
+	LCD_byte(0x80|addr); // Set DDRAM address command
+	Timer3us(40); // Also 37us to execute
+	lcd_cursor=addr;
+}
+
 void LCD_4BIT (void)
 {
+	unsigned char j;
+
 	LCD_E=0; // Resting state of LCD's enable is zero
 	// LCD_RW=0; // We are only writing to the LCD in this program
 	waitms(20);
@@ -166,16 +300,42 @@ void LCD_4BIT (void)
 	WriteCommand(0x0c);
 	WriteCommand(0x01); // Clear screen command (takes some time)
 	waitms(20); // Wait for clear screen command to finsih.
+
+	for(j=0; j<CHARS_PER_LINE; j++)
+	{
+		lcd_shadow[0][j]=' ';
+		lcd_shadow[1][j]=' ';
+	}
+	lcd_cursor=0; // Clear screen also moves the cursor home
 }
 
-void LCDprint(char * string, unsigned char line, bit clear)
+// Writes 'string' at column 'col' of 'line' but only sends the characters that
+// differ from what the LCD is already showing.  The cursor address is only set
+// when the next changed cell is not where the cursor already is.
+void LCD_Update(char * string, unsigned char line, unsigned char col, bit clear)
 {
-	int j;
+	unsigned char addr;
+	char c;
+	char xdata * shown;
 
-	WriteCommand(line==2?0xc0:0x80);
-	waitms(5);
-	for(j=0; string[j]!=0; j++)	WriteData(string[j]);// Write the message
-	if(clear) for(; j<CHARS_PER_LINE; j++) WriteData(' '); // Clear the rest of the line
+	shown=lcd_shadow[line==2?1:0];
+	addr=(line==2?0x40:0x00)+col;
+	for(; col<CHARS_PER_LINE; col++, addr++)
+	{
+		if(*string) c=*string++;
+		else if(clear) c=' '; // Clear the rest of the line
+		else break;
+		if(shown[col]==c) continue; // Already showing
+		if(lcd_cursor!=addr) LCD_goto(addr);
+		WriteData(c);
+		shown[col]=c;
+		lcd_cursor++; // The LCD moves the cursor right after each write
+	}
+}
+
+void LCDprint(char * string, unsigned char line, bit clear)
+{
+	LCD_Update(string, line, 0, clear);
 }
 
 int getsn (char * buff, int len)
@@ -205,6 +365,288 @@ void TIMER0_Init(void)
 	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
 	TMOD|=0b_0000_0101; // Timer/Counter 0 used as a 16-bit counter
 	TR0=0; // Stop Timer/Counter 0
+	PT0=1; // High priority: other interrupts must not delay the edge timestamps
+	ET0=1; // Enable Timer/Counter 0 interrupt
+}
+
+// Timer 2 is the free running timebase: SYSCLK/12, extended to 32 bits by its ISR.
+void TIMER2_Init(void)
+{
+	TMR2CN0=0x00;   // Stop Timer2; Clear TF2H, clock is SYSCLK/12
+	TMR2RL=0;       // Free running 16-bit timer
+	TMR2=0;
+	timebase_overflow=0;
+	PT2=1;          // High priority, like Timer 0, so Timer0_ISR never runs in the middle of it
+	ET2=1;          // Enable Timer2 interrupts
+	TR2=1;          // Start Timer2
+}
+
+void Timer2_ISR (void) interrupt INTERRUPT_TIMER2
+{
+	TF2H = 0; // Clear Timer2 interrupt flag
+	timebase_overflow++;
+}
+
+// Returns the 32-bit timebase.  Call it with the Timer 2 interrupt disabled.  Not from an
+// ISR: SDCC keeps the locals in fixed memory, so Timer0_ISR has its own copy of this.
+unsigned long Timebase_Read(void)
+{
+	unsigned char hi, lo;
+	unsigned int upper;
+
+	do {
+		hi=TMR2H;
+		lo=TMR2L;
+	} while(hi!=TMR2H); // Read again if the low byte rolled over between the two reads
+	upper=timebase_overflow;
+	if(TF2H && (hi<0x80)) upper++; // Overflowed, but the ISR didn't run yet
+	return ((unsigned long)upper<<16)|((unsigned int)hi<<8)|lo;
+}
+
+void Timer0_ISR (void) interrupt INTERRUPT_TIMER0
+{
+	unsigned char hi, lo;
+	unsigned int upper;
+
+	if(reciprocal_mode)
+	{
+		// Timer 0 overflowed on an input edge: timestamp it.  The fixed part of the
+		// latency is the same for the first and last edge, so it cancels out.  Only
+		// Timer2_ISR, the other high priority interrupt, can add to it: at most its
+		// length, about two timebase ticks.  This is Timebase_Read(), which main may be
+		// in the middle of: Reciprocal_Time() only masks the Timer 2 interrupt.
+		do {
+			hi=TMR2H;
+			lo=TMR2L;
+		} while(hi!=TMR2H);
+		upper=timebase_overflow;
+		if(TF2H && (hi<0x80)) upper++;
+		edge_time[edge_captures]=((unsigned long)upper<<16)|((unsigned int)hi<<8)|lo;
+		if(++edge_captures==2) TR0=0;
+	}
+	else
+	{
+		overflow_count++; // Extend the gated count past 16 bits
+	}
+}
+
+// Counts the input edges during 'gate' timebase ticks.  Sets freq_ticks to the
+// actual gate length and returns the count.
+unsigned long Gated_Count(unsigned long gate)
+{
+	unsigned long start, now;
+
+	reciprocal_mode=0;
+	TR0=0;
+	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
+	TMOD|=0b_0000_0101; // Timer/Counter 0 used as a 16-bit counter
+	TL0=0;
+	TH0=0;
+	TF0=0;
+	overflow_count=0;
+
+	EA=0;
+	TR0=1; // Open the gate
+	start=Timebase_Read();
+	EA=1;
+	while(1)
+	{
+		EA=0;
+		now=Timebase_Read();
+		if((now-start)>=gate) break;
+		EA=1;
+	}
+	TR0=0; // Close the gate
+	if(TF0) // Overflow not serviced yet
+	{
+		TF0=0;
+		overflow_count++;
+	}
+	EA=1;
+
+	freq_ticks=now-start;
+	return overflow_count*0x10000L+TH0*0x100L+TL0;
+}
+
+// Reciprocal counting: times 'n' (1 to 256) input periods against the timebase.
+// Timer 0 counts the edges in 8-bit auto-reload mode so no edge is lost while the
+// ISR timestamps the first edge and the edge 'n' periods later.  Returns 0 on timeout.
+bit Reciprocal_Time(unsigned int n)
+{
+	unsigned long start, now;
+
+	TR0=0;
+	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
+	TMOD|=0b_0000_0110; // Timer/Counter 0 used as an 8-bit counter with auto-reload
+	TH0=256-n;  // Overflow every 'n' edges
+	TL0=0xff;   // The next edge overflows and starts the measurement
+	TF0=0;
+	edge_captures=0;
+	reciprocal_mode=1;
+
+	EA=0;
+	start=Timebase_Read();
+	EA=1;
+	TR0=1;
+	while(edge_captures<2)
+	{
+		ET2=0; // Not EA=0: that would hold off the edge interrupt
+		now=Timebase_Read();
+		ET2=1;
+		if((now-start)>FREQ_TIMEOUT_TICKS)
+		{
+			TR0=0; // No signal
+			reciprocal_mode=0;
+			return 0;
+		}
+	}
+	reciprocal_mode=0;
+
+	freq_events=n;
+	freq_ticks=edge_time[1]-edge_time[0];
+	return 1;
+}
+
+// Auto-ranging frequency measurement.  A short gated count estimates the frequency.
+// If it already has FREQ_RESOLUTION counts it is the reading (high frequencies).
+// Otherwise just enough periods to span FREQ_RESOLUTION timebase ticks are timed
+// (low frequencies).  Either way the relative resolution is about the same and the
+// gate is as short as it can be.  Returns 0 if there is no input signal.
+bit Measure_Frequency(void)
+{
+	unsigned long count, n;
+
+	count=Gated_Count(FREQ_PROBE_TICKS);
+	if(count>=FREQ_RESOLUTION)
+	{
+		freq_events=count;
+		return 1;
+	}
+
+	// n periods take n*FREQ_PROBE_TICKS/count ticks.  Make that at least FREQ_RESOLUTION.
+	n=(count*FREQ_RESOLUTION+FREQ_PROBE_TICKS-1)/FREQ_PROBE_TICKS;
+	if(n<1) n=1;
+	if(n>FREQ_MAX_PERIODS) n=FREQ_MAX_PERIODS;
+	return Reciprocal_Time(n);
+}
+
+// Fixed point measurement math.  The 8051 has no floating point hardware, so readings
+// stay as counts and timer ticks and are only scaled to integers in display units.
+// C=1.44/((RA+2*RB)*F) in pF is freq_ticks*CAP_PF_NUM/(freq_events*CAP_PF_DEN).  The
+// division is left to Mul_Div() so no precision is lost for any RA and RB.  CAP_PF_DEN
+// times the most edges Timer 0 can count in a FREQ_PROBE_TICKS gate stays below 2^31.
+#define CAP_PF_NUM (1440000000L/(RA+2*RB))
+#define CAP_PF_DEN (TIMEBASE/1000L)
+
+// Returns a*b/c without a 64-bit intermediate: 'a' is added once for each bit of 'b'
+// while the quotient and remainder of the running product are kept apart.
+// c must be below 2^31.
+unsigned long Mul_Div(unsigned long a, unsigned long b, unsigned long c)
+{
+	unsigned long q=0, r=0, aq, ar;
+	unsigned char i;
+
+	aq=a/c;
+	ar=a%c;
+	for(i=0; i<32; i++)
+	{
+		q<<=1; // Double the running product
+		r<<=1;
+		if(r>=c)
+		{
+			r-=c;
+			q++;
+		}
+		if(b&0x80000000L) // Add 'a' for this bit of 'b'
+		{
+			q+=aq;
+			r+=ar;
+			if(r>=c)
+			{
+				r-=c;
+				q++;
+			}
+		}
+		b<<=1;
+	}
+	return q;
+}
+
+// Formats 'value' with 'decimals' implied decimal places: (1234, 2) gives "12.34".
+// Used instead of printf("%.2f") so the float formatting code is not needed.
+char * Fixed_to_str(char * buff, long value, unsigned char decimals)
+{
+	char tmp[12];
+	unsigned char n=0, j=0;
+	unsigned long v;
+
+	if(value<0)
+	{
+		buff[j++]='-';
+		v=-value;
+	}
+	else
+	{
+		v=value;
+	}
+	do {
+		if((n==decimals) && (decimals!=0)) tmp[n++]='.';
+		tmp[n++]='0'+(v%10);
+		v/=10;
+	} while((v!=0) || (n<=decimals));
+	while(n) buff[j++]=tmp[--n];
+	buff[j]=0;
+	return buff;
+}
+
+// Binary telemetry frame: sync byte (0xA5), channel id, sequence number, 32-bit
+// little-endian fixed point value and CRC-8 (polynomial 0x07) of the six bytes
+// between the sync byte and the CRC.  Channel ids and units are listed in lab3_graph.py.
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_FREQUENCY   0x10 // Hundredths of Hz
+#define TELEMETRY_CAPACITANCE 0x11 // pF
+
+unsigned char telemetry_seq;
+
+unsigned char CRC8(unsigned char crc, unsigned char x)
+{
+	unsigned char j;
+
+	crc^=x;
+	for(j=0; j<8; j++)
+	{
+		if(crc&0x80) crc=(crc<<1)^0x07;
+		else crc<<=1;
+	}
+	return crc;
+}
+
+// Sends one byte as is.  putchar() may turn '\n' into "\r\n".
+void Send_Byte(unsigned char x)
+{
+	while(!TI);
+	TI=0;
+	SBUF0=x;
+}
+
+void Send_Frame(unsigned char channel, unsigned long value)
+{
+	unsigned char frame[6];
+	unsigned char crc=0, j;
+
+	frame[0]=channel;
+	frame[1]=telemetry_seq++;
+	frame[2]=value;
+	frame[3]=value>>8;
+	frame[4]=value>>16;
+	frame[5]=value>>24;
+	Send_Byte(TELEMETRY_SYNC);
+	for(j=0; j<6; j++)
+	{
+		Send_Byte(frame[j]);
+		crc=CRC8(crc, frame[j]);
+	}
+	Send_Byte(crc);
 }
 
 const char* unit(int i){
@@ -224,49 +666,73 @@ const char* unit(int i){
 }
 void main (void) 
 {
-	unsigned long frequency;
+	unsigned long frequency;   // Hundredths of Hz
 	int capacitance_prefix_count = 0;
-	float capacitance;
+	unsigned long capacitance; // Hundredths of the unit given by capacitance_prefix_count
 	char display_buffer_1[17];
 	char display_buffer_2[17];
+	char number[12];
 
 	TIMER0_Init();
+	TIMER2_Init();
+	TIMER3_Init();
+	EA=1; // Enable global interrupts
 
 	waitms(500);
 
+#if (BINARY_TELEMETRY==0)
 	printf("\x1b[2J"); // Clear screen using ANSI escape sequence.
 	
 	printf ("EFM8 Frequency measurement using Timer/Counter 0.\n"
 	        "File: %s\n"
 	        "Compiled: %s, %s\n\n",
 	        __FILE__, __DATE__, __TIME__);
+#endif
 	        
 	LCD_4BIT();
+	SoftTimer_Start(SOFT_TIMER_LCD, LCD_REFRESH_MS);
 
 	while(1){
-		TL0 = 0;
-		TH0 = 0;
-		overflow_count = 0;
-		TF0 = 0;
 		capacitance_prefix_count = 0;
-		TR0 = 1;
-		waitms(1000);
-		TR0 = 0;
-		frequency=overflow_count*0x10000L+TH0*0x100L+TL0;
+		if(!Measure_Frequency())
+		{
+#if (BINARY_TELEMETRY==0)
+			printf("\rNo signal");
+			printf("\x1b[0K");
+#endif
+			LCDprint("Capacitance",1,1);
+			LCDprint("No signal",2,1);
+			continue;
+		}
+		frequency=Mul_Div(freq_events, TIMEBASE*100L, freq_ticks);
 
-		capacitance = 1.44/(RA+2*RB)/frequency;
+		capacitance = Mul_Div(freq_ticks, CAP_PF_NUM, freq_events*CAP_PF_DEN); // pF
+#if (BINARY_TELEMETRY==1)
+		Send_Frame(TELEMETRY_FREQUENCY, frequency);
+		Send_Frame(TELEMETRY_CAPACITANCE, capacitance);
+#endif
 		
-		while(capacitance < 1){
-			capacitance_prefix_count +=3;
-			capacitance*=1000;
+		if(capacitance < 1000L){
+			capacitance_prefix_count = 12;
+			capacitance = Mul_Div(freq_ticks, CAP_PF_NUM*100L, freq_events*CAP_PF_DEN);
+		}else{
+			capacitance_prefix_count = 9;
+			capacitance /= 10;
+			while(capacitance >= 100000L){
+				capacitance_prefix_count -=3;
+				capacitance /= 1000;
+			}
 		}
 
-		printf("\rF = %luHz", frequency);
+#if (BINARY_TELEMETRY==0)
+		printf("\rF = %sHz", Fixed_to_str(number, frequency, 2));
 		printf("\x1b[0k");
+#endif
+		if(!SoftTimer_Expired(SOFT_TIMER_LCD)) continue; // Keep measuring, the LCD is refreshed less often
 		//sprintf(display_buffer_1,"F = %d Hz", frequency);
 		//LCDprint(display_buffer_1,1,1);
 		sprintf(display_buffer_1,"Capacitance");
-		sprintf(display_buffer_2,"C= %.2f %sF", capacitance, unit(capacitance_prefix_count));
+		sprintf(display_buffer_2,"C= %s %sF", Fixed_to_str(number, capacitance, 2), unit(capacitance_prefix_count));
 		LCDprint(display_buffer_1,1,1);
 		LCDprint(display_buffer_2,2,1);
 	        sprintf(display_buffer_2,"                ");
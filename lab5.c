@@ -177,37 +177,318 @@ unsigned int ADC_at_Pin(unsigned char pin)
 	return (ADC0);
 }
 
-float Volts_at_Pin(unsigned char pin)
+// Fixed point measurement math.  The 8051 has no floating point hardware, so signals are
+// compared as raw ADC codes and timer ticks, and only converted to engineering units as
+// integers (millivolts, microseconds, millidegrees) when they are displayed.
+#define TIMER0_HZ (SYSCLK/12L) // Timer 0 ticks per second
+#define TICKS_TO_US(t) ((t)/(TIMER0_HZ/1000000L))
+
+// Formats 'value' with 'decimals' implied decimal places: (1234, 2) gives "12.34".
+// Used instead of printf("%.2f") so the float formatting code is not needed.
+char * Fixed_to_str(char * buff, long value, unsigned char decimals)
 {
-	 return ((ADC_at_Pin(pin)*VDD)/0b_0011_1111_1111_1111);
+	char tmp[12];
+	unsigned char n=0, j=0;
+	unsigned long v;
+
+	if(value<0)
+	{
+		buff[j++]='-';
+		v=-value;
+	}
+	else
+	{
+		v=value;
+	}
+	do {
+		if((n==decimals) && (decimals!=0)) tmp[n++]='.';
+		tmp[n++]='0'+(v%10);
+		v/=10;
+	} while((v!=0) || (n<=decimals));
+	while(n) buff[j++]=tmp[--n];
+	buff[j]=0;
+	return buff;
 }
 
-// Uses Timer3 to delay <us> micro-seconds. 
-void Timer3us(unsigned char us)
+// atan(2^-i) in millidegrees
+code long cordic_atan[16]={
+	45000, 26565, 14036, 7125, 3576, 1790, 895, 448,
+	224, 112, 56, 28, 14, 7, 3, 2
+};
+
+// CORDIC vectoring: rotates (x, y) onto the x axis using only shifts and adds.
+// Returns the angle of (x, y) in millidegrees and leaves 1.6468*|(x, y)| in *mag.
+// |x| and |y| must be below 2^28 so nothing overflows.
+long Cordic_Vector(long x, long y, long * mag)
 {
-	unsigned char i;               // usec counter
-	
-	// The input for Timer 3 is selected as SYSCLK by setting T3ML (bit 6) of CKCON0:
-	CKCON0|=0b_0100_0000;
-	
-	TMR3RL = (-(SYSCLK)/1000000L); // Set Timer3 to overflow in 1us.
-	TMR3 = TMR3RL;                 // Initialize Timer3 for first overflow
-	
-	TMR3CN0 = 0x04;                 // Sart Timer3 and clear overflow flag
-	for (i = 0; i < us; i++)       // Count <us> overflows
+	long angle=0, t;
+	unsigned char i;
+
+	if(x<0) // Move to the right half plane first
+	{
+		x=-x;
+		y=-y;
+		angle=180000L;
+	}
+	for(i=0; i<16; i++)
+	{
+		if(y>0)
+		{
+			t=x+(y>>i);
+			y-=(x>>i);
+			angle+=cordic_atan[i];
+		}
+		else
+		{
+			t=x-(y>>i);
+			y+=(x>>i);
+			angle-=cordic_atan[i];
+		}
+		x=t;
+	}
+	if(angle>180000L) angle-=360000L;
+	*mag=x;
+	return angle;
+}
+
+// Timer-paced sampling: Timer 2 overflows start the conversions (ADCM=TIMER2) and the
+// ADC end-of-conversion ISR stores the results in a ring buffer.  With more than one
+// channel the ISR switches the mux after each conversion, so the samples are interleaved
+// in the order of the channel list.
+#define ADC_RING_SIZE 256 // Must be 256: the 8-bit ring indices wrap around by themselves
+#define ADC_MAX_CHANNELS 4
+
+xdata unsigned int adc_ring[ADC_RING_SIZE];
+volatile unsigned char adc_head; // Written by the ISR
+volatile unsigned char adc_tail; // Written by the main program
+volatile unsigned int adc_overruns; // Sample frames dropped because the ring was full
+unsigned char adc_channels[ADC_MAX_CHANNELS];
+unsigned char adc_nchannels;
+volatile unsigned char adc_chan_index;
+volatile bit adc_dropping;
+
+void ADC_EOC_ISR (void) interrupt INTERRUPT_ADC0EOC
+{
+	ADINT=0;
+	// Decide at the start of each frame so channels never get out of step when full
+	if(adc_chan_index==0)
+	{
+		adc_dropping=((unsigned char)(adc_tail-adc_head-1))<adc_nchannels;
+		if(adc_dropping) adc_overruns++;
+	}
+	if(!adc_dropping)
+	{
+		adc_ring[adc_head]=ADC0;
+		adc_head++;
+	}
+	if(++adc_chan_index==adc_nchannels) adc_chan_index=0;
+	ADC0MX=adc_channels[adc_chan_index]; // Channel for the next conversion
+}
+
+// Starts conversions on Timer 2 overflows, 'rate' conversions per second
+void ADC_Timer2_Start(unsigned long rate)
+{
+	TMR2CN0=0x00; // Stop Timer2; Clear TF2H
+	if(rate<=(SYSCLK/12L/0x10000L)) rate=(SYSCLK/12L/0x10000L)+1; // Slowest rate Timer 2 can do
+	if((SYSCLK/rate)<=0x10000L)
+	{
+		CKCON0|=0b_0001_0000; // Timer 2 uses SYSCLK
+		TMR2RL=0x10000L-(SYSCLK/rate);
+	}
+	else
+	{
+		CKCON0&=~0b_0001_0000; // Timer 2 uses SYSCLK/12 for the slow rates
+		TMR2RL=0x10000L-(SYSCLK/12L/rate);
+	}
+	TMR2=TMR2RL;
+	ADC0CN2=(ADC0CN2&0xf0)|0x2; // ADCM: conversions start on Timer 2 overflow
+	TR2=1; // Start Timer2
+}
+
+void ADC_Timer2_Stop(void)
+{
+	TR2=0;
+	ADC0CN2&=0xf0; // ADCM: back to ADBUSY for ADC_at_Pin() and Get_ADC()
+	ADINT=0;
+}
+
+// Slowest rate Timer 2 can pace, and the fastest the ADC and the ISR keep up with: a
+// conversion takes about 3.2us (2.1us tracking, then 14 bits at 14.4MHz) and
+// ADC_EOC_ISR about 1us.
+#define ADC_STREAM_MIN_RATE (SYSCLK/12L/0x10000L+1)
+#define ADC_STREAM_MAX_RATE 200000L
+
+// Starts sampling 'nchannels' channels, 'rate' conversions per second in total.  The
+// rate is kept between ADC_STREAM_MIN_RATE and ADC_STREAM_MAX_RATE.  Returns the rate used.
+unsigned long ADC_Stream_Start(unsigned long rate, unsigned char * channels, unsigned char nchannels)
+{
+	unsigned char j;
+
+	if(rate<ADC_STREAM_MIN_RATE) rate=ADC_STREAM_MIN_RATE;
+	if(rate>ADC_STREAM_MAX_RATE) rate=ADC_STREAM_MAX_RATE;
+	EIE1&=~0x08; // Disable ADC0 end of conversion interrupt
+	if(nchannels>ADC_MAX_CHANNELS) nchannels=ADC_MAX_CHANNELS;
+	for(j=0; j<nchannels; j++) adc_channels[j]=channels[j];
+	adc_nchannels=nchannels;
+	adc_chan_index=0;
+	adc_head=0;
+	adc_tail=0;
+	adc_overruns=0;
+	ADC0MX=adc_channels[0];
+
+	ADINT=0;
+	EIE1|=0x08; // Enable ADC0 end of conversion interrupt
+	EA=1;
+	ADC_Timer2_Start(rate);
+	return rate;
+}
+
+void ADC_Stream_Stop(void)
+{
+	EIE1&=~0x08;
+	ADC_Timer2_Stop();
+}
+
+// Waits for 'n' samples and moves them from the ring buffer to 'dest'.
+void ADC_Stream_Read(unsigned int xdata * dest, unsigned char n)
+{
+	while((unsigned char)(adc_head-adc_tail)<n); // Wait for the whole block
+	while(n--)
 	{
-		while (!(TMR3CN0 & 0x80));  // Wait for overflow
-		TMR3CN0 &= ~(0x80);         // Clear overflow indicator
+		*dest++=adc_ring[adc_tail];
+		adc_tail++;
 	}
-	TMR3CN0 = 0 ;                   // Stop Timer3 and clear overflow flag
 }
 
+// Timer 3 is the system tick: it runs free at SYSCLK/12 and overflows every millisecond.
+// The ISR counts the milliseconds; the count left in Timer 3 gives the microseconds.
+// Code that has to wait can take a deadline and poll Expired() instead of sleeping.
+#define TICK_COUNTS_PER_US (SYSCLK/12L/1000000L) // Timer 3 counts per microsecond
+#define TICK_COUNTS_PER_MS (SYSCLK/12L/1000L)
+#define TICK_RELOAD (0x10000L-TICK_COUNTS_PER_MS)
+
+volatile unsigned long tick_ms; // Milliseconds since TIMER3_Init()
+
+void TIMER3_Init(void)
+{
+	TMR3CN0=0x00; // Stop Timer3; Clear TF3H, clock is SYSCLK/12
+	CKCON0&=~0b_0100_0000; // T3ML=0: Timer 3 uses the clock selected in TMR3CN0
+	TMR3RL=TICK_RELOAD;
+	TMR3=TICK_RELOAD;
+	tick_ms=0;
+	EIE1|=0x80; // Enable Timer3 interrupt
+	TMR3CN0=0x04; // Start Timer3
+}
+
+void Timer3_ISR (void) interrupt INTERRUPT_TIMER3
+{
+	TMR3CN0&=~0x80; // Clear TF3H
+	tick_ms++;
+}
+
+// Returns the Timer 3 count, TICK_RELOAD to 0xffff
+unsigned int Timer3_Count(void)
+{
+	unsigned char hi, lo;
+
+	do {
+		hi=TMR3H;
+		lo=TMR3L;
+	} while(hi!=TMR3H); // Read again if the low byte rolled over between the two reads
+	return (hi*0x100)|lo;
+}
+
+// Returns the milliseconds and puts the Timer 3 counts into the current millisecond in 'counts'
+unsigned long Tick_Read(unsigned int * counts)
+{
+	unsigned int t;
+	unsigned long ms;
+
+	EIE1&=~0x80; // Keep the ISR out while tick_ms and Timer 3 are read
+	t=Timer3_Count();
+	ms=tick_ms;
+	if((TMR3CN0&0x80) && (t<(TICK_RELOAD+TICK_COUNTS_PER_MS/2))) ms++; // Overflowed, but the ISR didn't run yet
+	EIE1|=0x80;
+	*counts=t-TICK_RELOAD;
+	return ms;
+}
+
+unsigned long Tick_ms(void)
+{
+	unsigned int counts;
+	return Tick_Read(&counts);
+}
+
+// Wraps every 71 minutes, so only use it for differences
+unsigned long Tick_us(void)
+{
+	unsigned int counts;
+	unsigned long ms;
+
+	ms=Tick_Read(&counts);
+	return ms*1000L+counts/TICK_COUNTS_PER_US;
+}
+
+unsigned long Deadline_ms(unsigned int ms)
+{
+	return Tick_ms()+ms;
+}
+
+// 1 once the deadline has passed.  Works across the wrap of tick_ms.
+bit Expired(unsigned long deadline)
+{
+	return ((long)(Tick_ms()-deadline)>=0);
+}
+
+unsigned long Elapsed_ms(unsigned long since)
+{
+	return Tick_ms()-since;
+}
+
+// Periodic software timers on top of the tick.  SoftTimer_Expired() is true once per period.
+#define SOFT_TIMERS 4
+#define SOFT_TIMER_MEASURE 0
+#define MEASURE_PERIOD_MS 1500
+
+xdata unsigned long soft_deadline[SOFT_TIMERS];
+xdata unsigned int soft_period[SOFT_TIMERS];
+
+void SoftTimer_Start(unsigned char n, unsigned int period_ms)
+{
+	soft_period[n]=period_ms;
+	soft_deadline[n]=Deadline_ms(period_ms);
+}
+
+bit SoftTimer_Expired(unsigned char n)
+{
+	if(!Expired(soft_deadline[n])) return 0;
+	soft_deadline[n]+=soft_period[n]; // From the old deadline, so the period doesn't drift...
+	if(Expired(soft_deadline[n])) soft_deadline[n]=Deadline_ms(soft_period[n]); // ...unless it fell a whole period behind
+	return 1;
+}
+
+// Delays <us> micro-seconds by watching Timer 3.  Doesn't need interrupts.
+void Timer3us(unsigned char us)
+{
+	unsigned int start, now, elapsed;
+	unsigned int wait;
+
+	wait=us*TICK_COUNTS_PER_US;
+	start=Timer3_Count();
+	do {
+		now=Timer3_Count();
+		elapsed=now-start;
+		if(now<start) elapsed+=TICK_COUNTS_PER_MS; // Timer 3 reloaded in between
+	} while(elapsed<wait);
+}
+
+// Needs the Timer 3 interrupt, so call it with interrupts enabled
 void waitms (unsigned int ms)
 {
-	unsigned int j;
-	unsigned char k;
-	for(j=0; j<ms; j++)
-		for (k=0; k<4; k++) Timer3us(250);
+	unsigned long start;
+
+	start=Tick_us();
+	while((Tick_us()-start)<(ms*1000L));
 }
 
 void LCD_pulse (void)
@@ -239,7 +520,7 @@ void WriteData (unsigned char x)
 {
 	LCD_RS=1;
 	LCD_byte(x);
-	waitms(2);
+	Timer3us(40); // Data writes take 37us to execute (HD44780 data sheet)
 }
 
 void WriteCommand (unsigned char x)
@@ -249,8 +530,22 @@ void WriteCommand (unsigned char x)
 	waitms(5);
 }
 
+// Shadow copy of what the LCD is showing, so only the cells that change are sent
+xdata char lcd_shadow[2][CHARS_PER_LINE];
+unsigned char lcd_cursor; // DDRAM address of the LCD cursor
+
+void LCD_goto (unsigned char addr)
+{
+	LCD_RS=0;
+	LCD_byte(0x80|addr); // Set DDRAM address command
+	Timer3us(40); // Also 37us to execute
+	lcd_cursor=addr;
+}
+
 void LCD_4BIT (void)
 {
+	unsigned char j;
+
 	LCD_E=0; // Resting state of LCD's enable is zero
 	// LCD_RW=0; // We are only writing to the LCD in this program
 	waitms(20);
@@ -264,16 +559,42 @@ void LCD_4BIT (void)
 	WriteCommand(0x0c);
 	WriteCommand(0x01); // Clear screen command (takes some time)
 	waitms(20); // Wait for clear screen command to finsih.
+
+	for(j=0; j<CHARS_PER_LINE; j++)
+	{
+		lcd_shadow[0][j]=' ';
+		lcd_shadow[1][j]=' ';
+	}
+	lcd_cursor=0; // Clear screen also moves the cursor home
 }
 
-void LCDprint(char * string, unsigned char line, bit clear)
+// Writes 'string' at column 'col' of 'line' but only sends the characters that
+// differ from what the LCD is already showing.  The cursor address is only set
+// when the next changed cell is not where the cursor already is.
+void LCD_Update(char * string, unsigned char line, unsigned char col, bit clear)
 {
-	int j;
+	unsigned char addr;
+	char c;
+	char xdata * shown;
 
-	WriteCommand(line==2?0xc0:0x80);
-	waitms(5);
-	for(j=0; string[j]!=0; j++)	WriteData(string[j]);// Write the message
-	if(clear) for(; j<CHARS_PER_LINE; j++) WriteData(' '); // Clear the rest of the line
+	shown=lcd_shadow[line==2?1:0];
+	addr=(line==2?0x40:0x00)+col;
+	for(; col<CHARS_PER_LINE; col++, addr++)
+	{
+		if(*string) c=*string++;
+		else if(clear) c=' '; // Clear the rest of the line
+		else break;
+		if(shown[col]==c) continue; // Already showing
+		if(lcd_cursor!=addr) LCD_goto(addr);
+		WriteData(c);
+		shown[col]=c;
+		lcd_cursor++; // The LCD moves the cursor right after each write
+	}
+}
+
+void LCDprint(char * string, unsigned char line, bit clear)
+{
+	LCD_Update(string, line, 0, clear);
 }
 
 
@@ -308,259 +629,346 @@ int getsn (char * buff, int len)
 
 
 
-float HALFPERIOD_ADC_sig1(void)
-{
-	ADC0MX=QFP32_MUX_P2_1;
-	ADINT = 0;
-	ADBUSY=1;
-	while (!ADINT); // Wait for conversion to complete
-	// Reset the timer
-	TL0=0;
-	TH0=0;
-	while (Get_ADC()!=0); // Wait for the signal to be zero
-	while (Get_ADC()==0); // Wait for the signal to be positive
-	TR0=1; // Start the timer 0
-	while (Get_ADC()!=0); // Wait for the signal to be zero again
-	TR0=0; // Stop timer 0
-	return (TH0*256.0+TL0)*12.0/SYSCLK;
+// Zero crossing detector using the ADC window comparator.  Timer 2 paces the conversions
+// and the window is set so ADWINT only fires when the signal crosses a threshold: first
+// "below EDGE_LOW", then "above EDGE_HIGH", and so on.  The gap between the two thresholds
+// is the hysteresis.  The window ISR timestamps each crossing with Timer 0, so the edge
+// times come from the sample clock instead of the latency of a polling loop.
+#define EDGE_RATE 200000L // Conversions per second while looking for edges: 5us resolution
+#define EDGE_HIGH 100 // ADC codes (about 20mV): the signal is positive above this...
+#define EDGE_LOW   20 // ...and zero again below this
+#define EDGE_TIMEOUT_MS 1000 // How long to wait for an edge
 
+volatile unsigned int timer0_overflow; // Upper 16 bits of the Timer 0 timestamps
+volatile unsigned long edge_rise_time; // Timestamp of the last rising edge
+volatile unsigned long edge_fall_time; // Timestamp of the last falling edge
+volatile unsigned char edge_rises; // Rising edges since Edge_Start()
+volatile unsigned char edge_falls; // Falling edges since Edge_Start(), only after a rise
+volatile bit edge_above; // 1: waiting for the signal to go above EDGE_HIGH
+
+void Timer0_ISR (void) interrupt INTERRUPT_TIMER0
+{
+	timer0_overflow++;
 }
 
-float HALFPERIOD_ADC_sig2(void)
+// Returns the 32-bit Timer 0 timestamp.  Call it from an ISR or with interrupts disabled.
+unsigned long Timer0_Read(void)
 {
-	ADC0MX=QFP32_MUX_P2_2;
-	ADINT = 0;
-	ADBUSY=1;
-	while (!ADINT); // Wait for conversion to complete
-	// Reset the timer
-	TL0=0;
-	TH0=0;
-	while (Get_ADC()!=0); // Wait for the signal to be zero
-	while (Get_ADC()==0); // Wait for the signal to be positive
-	TR0=1; // Start the timer 0
-	while (Get_ADC()!=0); // Wait for the signal to be zero again
-	TR0=0; // Stop timer 0
-	return (TH0*256.0+TL0)*12.0/SYSCLK;
-
-}
-float time_diff_ADC(void)
-{
-	//float time_diff;
-	unsigned int overflow_count=0;
-	// Reset the timer
-	TR0 = 0;
-	TL0=0;
-	TH0=0;
-	//ADC_at_Pin(QFP32_MUX_P2_1);
-	
-	//while(ADC_at_Pin(QFP32_MUX_P2_1)!=0);
-	//while(ADC_at_Pin(QFP32_MUX_P2_1)==0);
-	
+	unsigned char hi, lo;
+	unsigned int upper;
+
+	do {
+		hi=TH0;
+		lo=TL0;
+	} while(hi!=TH0); // Read again if the low byte rolled over between the two reads
+	upper=timer0_overflow;
+	if(TF0 && (hi<0x80)) upper++; // Overflowed, but the ISR didn't run yet
+	return ((unsigned long)upper<<16)|((unsigned int)hi<<8)|lo;
+}
 
-	//ADC_at_Pin()
-	//ADINT = 0;
-	//ADBUSY=1;
-	//while (!ADINT); // Wait for conversion to complete
+void ADC_WC_ISR (void) interrupt INTERRUPT_ADC0WC
+{
+	unsigned long now;
 
-	while (ADC_at_Pin(QFP32_MUX_P2_2)!=0); // Wait for the signal to be zero
-	while (ADC_at_Pin(QFP32_MUX_P2_2)==0);
-	//while (Get_ADC()==0); // Wait for the signal to be positive
-	
-	//ADC0MX=QFP32_MUX_P2_2;	
-	TR0 = 1;
-	while(ADC_at_Pin(QFP32_MUX_P2_1)!=0) // Wait for the signal to be zero
+	now=Timer0_Read();
+	ADWINT=0;
+	if(edge_above)
 	{
-		if(TF0==1) // Did the 16-bit timer overflow?
-		{
-			TF0=0;
-			overflow_count++;
-		}
+		// Went above EDGE_HIGH: rising edge.  Now wait for ADC0<EDGE_LOW.
+		ADC0LT=EDGE_LOW;
+		ADC0GT=0xffff;
+		edge_above=0;
+		edge_rise_time=now;
+		edge_rises++;
 	}
-	while(ADC_at_Pin(QFP32_MUX_P2_1)==0) // Wait for the signal to be one
+	else
 	{
-		if(TF0==1) // Did the 16-bit timer overflow?
+		// Went below EDGE_LOW: falling edge.  Now wait for ADC0>EDGE_HIGH.
+		ADC0LT=0;
+		ADC0GT=EDGE_HIGH;
+		edge_above=1;
+		if(edge_rises!=0)
 		{
-			TF0=0;
-			overflow_count++;
+			edge_fall_time=now;
+			edge_falls++;
 		}
 	}
-	TR0=0; // Stop timer 0, the 24-bit number [overflow_count-TH0-TL0] has the period!
-		
-	return (overflow_count*65536.0+TH0*256.0+TL0)*(12.0/SYSCLK);
-
 }
 
-
-float time_diff_two(void){
-	unsigned int overflow_count=0;
-	float diff;
-	TR0 = 0;
-	TL0=0;
-	TH0=0;
-	
-	while(Volts_at_Pin(QFP32_MUX_P2_1)!=0); // Wait for the signal to be zero
-	while(Volts_at_Pin(QFP32_MUX_P2_1)!=1); // Wait for the signal to be one
-	TR0=1; // Start the timer
-	if(Volts_at_Pin(QFP32_MUX_P2_2) == 0)
-	{
-		TR0 = 1;
-		while(Volts_at_Pin(QFP32_MUX_P2_2)==0);
-		TR0 = 0;
-		diff = (TH0*256.0+TL0)*12.0/SYSCLK;
-	}
-	else
+// Starts looking for edges at 'pin'.  Timer 0 keeps running if it already is, so
+// timestamps taken on different pins can be compared.
+void Edge_Start(unsigned char pin)
+{
+	EIE1&=~0x04; // Disable ADC0 window compare interrupt
+	ADC_Timer2_Stop();
+	ADC0MX=pin;
+	edge_rises=0;
+	edge_falls=0;
+	// ADC0LT<ADC0GT: ADWINT is set when ADC0<ADC0LT or ADC0>ADC0GT
+	ADC0LT=EDGE_LOW;
+	ADC0GT=0xffff;
+	edge_above=0;
+	ADWINT=0;
+	if(!TR0)
 	{
-		TR0 = 1;
-		while(Volts_at_Pin(QFP32_MUX_P2_2)!=0);
-		TR0 = 0;
-		diff = (TH0*256.0+TL0)*12.0/SYSCLK;
+		TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
+		TMOD|=0b_0000_0001; // Timer/Counter 0 used as a 16-bit timer
+		TF0=0;
+		timer0_overflow=0;
+		ET0=1;
+		TR0=1;
 	}
-	
-	return diff;
+	EIE1|=0x04; // Enable ADC0 window compare interrupt
+	EA=1;
+	ADC_Timer2_Start(EDGE_RATE);
 }
 
-float PeakPeriod(float halfP){
-	return halfP/2;
+void Edge_Stop(void)
+{
+	EIE1&=~0x04;
+	ADC_Timer2_Stop();
+	ADWINT=0;
+	TR0=0;
+	ET0=0;
+	TF0=0;
 }
 
-float FullPeriod(float halfP){
-	return halfP*2;
+// Waits until the ISR has counted an edge in '*count'.  0 if none came in time.
+bit Edge_Wait(unsigned char volatile * count)
+{
+	unsigned long deadline;
+
+	deadline=Deadline_ms(EDGE_TIMEOUT_MS);
+	while(*count==0)
+	{
+		if(Expired(deadline)) return 0;
+	}
+	return 1;
 }
 
+// Returns the time the signal at 'pin' is positive in Timer 0 ticks.  0 if no edges.
+unsigned long Edge_High_Time(unsigned char pin)
+{
+	unsigned long t=0;
 
-float timeDifference(unsigned char reference_pin, unsigned char other_pin){
-	
-	unsigned int overflow_count=0;
-	TR0 = 0;		// stop timer 0
-	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
-    TMOD|=0b_0000_0001; // Timer/Counter 0 used as a 16-bit timer
-    TH0 = 0;		//high bits to 0
-    TL0 = 0;		//low bits to 0
-    TF0 = 0;		//overflow bits to 0
-	//unsigned int overflow_count=0;
-	
-	while (Volts_at_Pin(reference_pin) == 0);//wait for high 
-    while (Volts_at_Pin(reference_pin) == 1);//wait for low 
-	
-	TR0 = 1; //start timer 0
-	
-	while(Volts_at_Pin(other_pin)==0) // Wait for the signal to be 1
+	Edge_Start(pin);
+	if(Edge_Wait(&edge_falls)) // The first counted fall always follows the first rise
 	{
-		if(TF0==1) // Did the 16-bit timer overflow ?
-		{
-			TF0=0;
-			overflow_count++;
-		}
+		EA=0; // The timestamps are 32 bits written by the ISR
+		t=edge_fall_time-edge_rise_time;
+		EA=1;
 	}
+	Edge_Stop();
+	return t;
+}
+
+// Hardware edge capture with PCA0.  The PCA counter runs free at SYSCLK and its overflow
+// interrupt extends it to 32 bits.  Capture modules 0 and 1 latch the counter on the edges
+// of the zero-crossing comparator outputs of signal 1 (CEX0, P0.6) and signal 2 (CEX1,
+// P0.7), so the timestamps have no software latency at all.  Each module alternates
+// between rising and falling edges so the ISR always knows which edge it got.
+#define PCA_HZ SYSCLK // PCA counter ticks per second
+#define CAPTURE_TIMEOUT_MS 1000 // How long to wait for edges
+#define CAPTURE_RISING  0x21 // PCA0CPMn: CAPP, ECCF
+#define CAPTURE_FALLING 0x11 // PCA0CPMn: CAPN, ECCF
+
+volatile unsigned int pca_overflow; // Upper 16 bits of the PCA timestamps
+volatile unsigned long cap_rise[2];   // Last rising edge of each channel
+volatile unsigned long cap_period[2]; // Between the last two rising edges
+volatile unsigned long cap_high[2];   // From the last rising edge to the falling edge after it
+volatile unsigned char cap_rises[2];  // Rising edges counted
+volatile bit cap_seen; // Set by the first rising edge on channel 0, never cleared
+volatile bit cap_wait_fall0;
+volatile bit cap_wait_fall1;
+
+void Capture_Edge(unsigned char ch, unsigned int captured, bit falling)
+{
+	unsigned int upper;
+	unsigned long now;
 
-    while(Volts_at_Pin(other_pin)==1) // Wait for the signal to be 0
+	upper=pca_overflow;
+	if(CF && (captured<0x8000)) upper++; // Captured after an overflow not counted yet
+	now=((unsigned long)upper<<16)|captured;
+	if(falling)
 	{
-		if(TF0==1) // Did the 16-bit timer overflow?
-		{
-			TF0=0;
-			overflow_count++;
-		}
+		cap_high[ch]=now-cap_rise[ch];
 	}
+	else
+	{
+		cap_period[ch]=now-cap_rise[ch];
+		cap_rise[ch]=now;
+		cap_rises[ch]++;
+		if(ch==0) cap_seen=1;
+	}
+}
 
-	TR0=0; // Stop timer 0, the 24-bit number [overflow_count-TH0-TL0] has the period!
-	return (overflow_count*65536.0+TH0*256.0+TL0)*(12.0/SYSCLK);
+void PCA_ISR (void) interrupt INTERRUPT_PCA0
+{
+	if(CCF0)
+	{
+		CCF0=0;
+		Capture_Edge(0, PCA0CP0, cap_wait_fall0);
+		cap_wait_fall0=!cap_wait_fall0;
+		PCA0CPM0=cap_wait_fall0?CAPTURE_FALLING:CAPTURE_RISING;
+	}
+	if(CCF1)
+	{
+		CCF1=0;
+		Capture_Edge(1, PCA0CP1, cap_wait_fall1);
+		cap_wait_fall1=!cap_wait_fall1;
+		PCA0CPM1=cap_wait_fall1?CAPTURE_FALLING:CAPTURE_RISING;
+	}
+	if(CF)
+	{
+		CF=0;
+		pca_overflow++;
+	}
 }
 
-float zero_cross_max_v_sig1(float halfperiod){
+void Capture_Init(void)
+{
+	// UART0 has fixed pins, P0.4 and P0.5.  The PCA pins go to the lowest pins not
+	// skipped, so skip P0.0 to P0.3 to put CEX0 on P0.6 and CEX1 on P0.7.
+	P0SKIP|=0b_0000_1111;
+	XBR1|=0x02; // PCA0ME: CEX0 and CEX1 on the crossbar
+	PCA0CN0=0x00; // Stop the PCA counter; clear all flags
+	PCA0MD=(0x4<<1)|0x01; // CPS: SYSCLK; ECF: interrupt on counter overflow
+	PCA0=0;
+	pca_overflow=0;
+	cap_rises[0]=0;
+	cap_rises[1]=0;
+	cap_seen=0;
+	cap_wait_fall0=0;
+	cap_wait_fall1=0;
+	PCA0CPM0=CAPTURE_RISING;
+	PCA0CPM1=CAPTURE_RISING;
+	EIE1|=0x10; // Enable PCA0 interrupt
+	EA=1;
+	CR=1; // Start the PCA counter
+}
 
-	unsigned int overflow_count=0;
-	TH0 = 0; 
-	TL0 = 0;
-	TF0 = 0;
+// Waits for 'n' new rising edges on channel 'ch'.  Returns 0 on timeout, for example
+// when the comparator outputs are not connected.
+bit Capture_Wait(unsigned char ch, unsigned char n)
+{
+	unsigned char start_rises;
+	unsigned long deadline;
 
-	ADC0MX=QFP32_MUX_P2_1;
-	ADINT = 0;
-	ADBUSY=1;
-	while (!ADINT); // Wait for conversion to complete
-	// Reset the timer
-	while (Get_ADC()!=0); // Wait for the signal to be zero wait high 
-	while (Get_ADC()==0); // Wait for the signal to be positive low 
-	//TR0=1; // Start the timer 0
-	//while (Get_ADC()!=0); // Wait for the signal to be zero again
-	//TR0=0; // Stop timer 0
-	//float half_period = TH0*256+TL0;	
-	//quarter_period = half_period/2;
-	
-	//overflow_count = 65536-halfperiod/2;
-	waitms(halfperiod*500);
-	//printf("%d\n",overflow_count);
-	return Volts_at_Pin(QFP32_MUX_P2_1);
+	start_rises=cap_rises[ch];
+	deadline=Deadline_ms(CAPTURE_TIMEOUT_MS);
+	while((unsigned char)(cap_rises[ch]-start_rises)<n)
+	{
+		if(Expired(deadline)) return 0;
+	}
+	return 1;
 }
 
-float zero_cross_max_v_sig2(float halfperiod){
-
-	unsigned int overflow_count=0;
-	TH0 = 0; 
-	TL0 = 0;
-	TF0 = 0;
+// The results are 32 bits written by the ISR, so read them with interrupts off.
+unsigned long Capture_Read(unsigned long volatile * result)
+{
+	unsigned long t;
 
-	ADC0MX=QFP32_MUX_P2_2;
-	ADINT = 0;
-	ADBUSY=1;
-	while (!ADINT); // Wait for conversion to complete
-	// Reset the timer
-	while (Get_ADC()!=0); // Wait for the signal to be zero wait high 
-	while (Get_ADC()==0); // Wait for the signal to be positive low 
-	//TR0=1; // Start the timer 0
-	//while (Get_ADC()!=0); // Wait for the signal to be zero again
-	//TR0=0; // Stop timer 0
-	//float half_period = TH0*256+TL0;	
-	//quarter_period = half_period/2;
-	
-	//overflow_count = 65536-halfperiod/2;
-	waitms(halfperiod*500);
-	//printf("%d\n",overflow_count);
-	return Volts_at_Pin(QFP32_MUX_P2_2);
+	EA=0;
+	t=*result;
+	EA=1;
+	return t;
 }
 
-float HalfPeriod_sig1(void){
+unsigned long Capture_Period(unsigned char ch)
+{
+	return Capture_Read(&cap_period[ch]);
+}
 
-	TR0 = 0;		// stop timer 0
-	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
-	TMOD|=0b_0000_0001; // Timer/Counter 0 used as a 16-bit timer
-    TH0 = 0;		//high bits to 0
-    TL0 = 0;		//low bits to 0
-    TF0 = 0;		//overflow bits to 0
+// Returns the time the signal is positive in Timer 0 ticks
+unsigned long HALFPERIOD_ADC_sig1(void)
+{
+	return Edge_High_Time(QFP32_MUX_P2_1);
+}
 
-	while(Volts_at_Pin(QFP32_MUX_P2_2) ==1);	//wait for signal be 0
-	while(Volts_at_Pin(QFP32_MUX_P2_2) ==0); //wait for signal be 1 
+unsigned long FullPeriod(unsigned long halfP){
+	return halfP*2L;
+}
 
-	TR0 = 1; //starting timer
+#define PHASOR_BLOCK 128 // Samples per block, both channels: one period of the signal
+#define PHASOR_N (PHASOR_BLOCK/2) // Samples per channel in a block
+#define HALF_WAVE 2.0 // The ADC reads the negative half-cycles as zero, which halves the fundamental
+#define PHASOR_SHIFT 4 // Keeps the DFT sums below 2^26 for Cordic_Vector()
+// Periods in Timer 0 ticks that one block can span at a rate ADC_Stream_Start() accepts
+#define PHASOR_MIN_PERIOD (PHASOR_BLOCK*TIMER0_HZ/ADC_STREAM_MAX_RATE) // 640us
+#define PHASOR_MAX_PERIOD (PHASOR_BLOCK*TIMER0_HZ/ADC_STREAM_MIN_RATE)
+// RMS millivolts per CORDIC magnitude unit, scaled by 2^30.  |X|=(N/2)*A*4096 with A in
+// 12-bit codes, and CORDIC returns 1.6468*|X|/2^PHASOR_SHIFT.
+#define PHASOR_MV_SCALE ((unsigned long)((1L<<PHASOR_SHIFT)/1.646760258*HALF_WAVE*2.0*4.0*VDD*1000.0/ \
+	(PHASOR_N*4096.0*16383.0*1.41421356237)*1073741824.0+0.5))
+
+unsigned char phasor_channels[2]={QFP32_MUX_P2_1, QFP32_MUX_P2_2};
+xdata unsigned int phasor_block[PHASOR_BLOCK];
+
+// cos(2*pi*n/PHASOR_N) in Q12.  sin() is the same table a quarter period earlier.
+code int phasor_cos[PHASOR_N]={
+	 4096,  4076,  4017,  3920,  3784,  3612,  3406,  3166,
+	 2896,  2598,  2276,  1931,  1567,  1189,   799,   401,
+	    0,  -401,  -799, -1189, -1567, -1931, -2276, -2598,
+	-2896, -3166, -3406, -3612, -3784, -3920, -4017, -4076,
+	-4096, -4076, -4017, -3920, -3784, -3612, -3406, -3166,
+	-2896, -2598, -2276, -1931, -1567, -1189,  -799,  -401,
+	    0,   401,   799,  1189,  1567,  1931,  2276,  2598,
+	 2896,  3166,  3406,  3612,  3784,  3920,  4017,  4076
+};
+
+// Single-bin DFT: the fundamental of one channel of an interleaved block that spans
+// exactly one period.  The samples are reduced to 12 bits so 12-bit samples times Q12
+// coefficients, summed PHASOR_N times, fit in 32 bits.  The DC level falls out.
+void Phasor_DFT(unsigned int xdata * x, long * re, long * im)
+{
+	unsigned char n;
+	long sum_re=0, sum_im=0;
+	int s;
 
-	while(Volts_at_Pin(QFP32_MUX_P2_2) ==1) //wait for signal be 0
+	for(n=0; n<PHASOR_N; n++)
+	{
+		s=x[n*2]>>2;
+		sum_re+=(long)s*phasor_cos[n];
+		sum_im-=(long)s*phasor_cos[(n-PHASOR_N/4)&(PHASOR_N-1)];
+	}
+	*re=sum_re;
+	*im=sum_im;
+}
 
-	TR0 = 0;
+// Converts a DFT bin to the RMS millivolts and the phase (millidegrees) of the fundamental
+long Phasor_Polar(long re, long im, unsigned int * rms_mV)
+{
+	long mag, phase;
 
-	return (TH0*0x100+TL0)*12/SYSCLK;
+	phase=Cordic_Vector(re>>PHASOR_SHIFT, im>>PHASOR_SHIFT, &mag);
+	*rms_mV=((unsigned long)(mag>>10)*PHASOR_MV_SCALE)>>20;
+	return phase;
 }
 
 void LCDprint2(char * string, unsigned char line, unsigned char col)
 {
-    int j;
-    WriteCommand(line==2?0xc0|col:0x80|col);
-    for(j=0; string[j]!=0; j++) WriteData(string[j]);
+    LCD_Update(string, line, col, 0);
 }
 
 
 void main(void)
 {
 
-	float vmax1 = 0;
-	float vmax2 = 0;
-	float halfPeriod = 0;
-	float fullPeriod = 0;
-	float timeDiff = 0;
-	float phaseDiff = 0;
+	unsigned int vmax1 = 0; // RMS millivolts
+	unsigned int vmax2 = 0;
+	long re1, im1, re2, im2;
+	unsigned long halfPeriod = 0; // Timer 0 ticks
+	unsigned long fullPeriod = 0;
+	long timeDiff = 0;  // Microseconds
+	long phaseDiff = 0; // Millidegrees
 	char display_buffer_1[17];
 	char display_buffer_2[17];
+	char number_1[12];
+	char number_2[12];
 	
 	TIMER0_Init();
-	
+	TIMER3_Init();
+	EA=1; // Enable global interrupts
 	
 	waitms(500);
 
@@ -571,8 +979,10 @@ void main(void)
 	InitPinADC(2, 4); // Configure P2.4 as analog input
 	InitPinADC(2, 1); // Configure P2.5 as analog input
     InitADC();
+    Capture_Init();
     
     LCD_4BIT();
+    SoftTimer_Start(SOFT_TIMER_MEASURE, MEASURE_PERIOD_MS);
     	
     //waitms(halfPeriod*1000/2);
     	
@@ -581,6 +991,7 @@ void main(void)
    	
     while(1)
     {
+		if(!SoftTimer_Expired(SOFT_TIMER_MEASURE)) continue; // One measurement every 1.5s, however long the last one took
     
     	vmax1 = 0;
     	vmax2 = 0;
@@ -589,37 +1000,59 @@ void main(void)
 		fullPeriod = 0;
 		timeDiff = 0;
 		phaseDiff = 0;
-		TL0 = 0;
-		TH0 = 0;
-		TF0 = 0;
-    	TR0 = 1;
-		waitms(1500);
-		TR0 = 0;
 		
-    	halfPeriod = HALFPERIOD_ADC_sig1();
-    	fullPeriod = FullPeriod(halfPeriod);
-    	
-    	printf("Period = %f\n", halfPeriod);
-    	printf("Period = %f\n", fullPeriod);
-  
+    	// With the comparator outputs on the PCA inputs the period comes from captured
+    	// timestamps; without them (no edge ever captured) fall back to the ADC zero crossings.
+    	if(cap_seen && Capture_Wait(0, 2))
+    	{
+    		fullPeriod = (Capture_Period(0)+6)/12; // PCA ticks to Timer 0 ticks
+    		halfPeriod = (Capture_Read(&cap_high[0])+6)/12;
+    	}
+    	else
+    	{
+    		halfPeriod = HALFPERIOD_ADC_sig1();
+    		fullPeriod = FullPeriod(halfPeriod);
+    	}
     	
-   		printf("voltage 2.1 = %f\n", zero_cross_max_v_sig1(halfPeriod));
+    	printf("Period = %luus\n", TICKS_TO_US(halfPeriod));
+    	printf("Period = %luus\n", TICKS_TO_US(fullPeriod));
     	
-    	vmax1 = zero_cross_max_v_sig1(halfPeriod)/1.41421356237;
-    	vmax2 = zero_cross_max_v_sig2(halfPeriod)/1.41421356237;
+    	// No edges gives a zero period.  Outside the range the block would not span
+    	// exactly one period and the phasors would be wrong.
+    	if((fullPeriod<PHASOR_MIN_PERIOD) || (fullPeriod>PHASOR_MAX_PERIOD))
+    	{
+    		LCDprint(fullPeriod==0?"No signal":"Out of range", 1, 1);
+    		LCDprint("", 2, 1);
+    		continue;
+    	}
     	
-   		timeDiff = time_diff_ADC();
+    	// Sample both signals over one full period and get both phasors in one pass
+    	ADC_Stream_Start(PHASOR_BLOCK*TIMER0_HZ/fullPeriod, phasor_channels, 2);
+    	ADC_Stream_Read(phasor_block, PHASOR_BLOCK);
+    	ADC_Stream_Stop();
+    	Phasor_DFT(&phasor_block[0], &re1, &im1);
+    	Phasor_DFT(&phasor_block[1], &re2, &im2);
     	
-  		printf("timediff = %f\n",timeDiff);
+    	// Signal 2 is sampled one sample period after signal 1: remove that phase shift
+   		phaseDiff = Phasor_Polar(re2, im2, &vmax2)-Phasor_Polar(re1, im1, &vmax1)-360000L/PHASOR_BLOCK;
     	
-   		phaseDiff = timeDiff*360/fullPeriod;
+   		printf("voltage 2.1 = %umV\n", vmax1);
     	
-    	if(phaseDiff>180){
-    		phaseDiff -=360;
+    	if(phaseDiff>180000L){
+    		phaseDiff -=360000L;
+    	}
+    	if(phaseDiff<=-180000L){
+    		phaseDiff +=360000L;
     	}
-    	printf("phaseDiff = %f\n",phaseDiff);
+   		timeDiff = (phaseDiff/10)*(long)TICKS_TO_US(fullPeriod)/36000L;
+    	
+  		printf("timediff = %ldus\n",timeDiff);
+    	printf("phaseDiff = %smdeg\n",Fixed_to_str(number_1, phaseDiff, 0));
     	
-    	fullPeriod *=1000;
+    	// Rounded to hundredths for the display
+    	phaseDiff = (phaseDiff+(phaseDiff<0?-5:5))/10;
+    	vmax1 = (vmax1+5)/10;
+    	vmax2 = (vmax2+5)/10;
     	//halfPeriod = 1000*newperiod(P2_4);
     	//halfPeriod = HALFPERIOD_ADC();
     	//fullPeriod = FullPeriod(halfPeriod);
@@ -644,10 +1077,10 @@ void main(void)
     	//timeDiff = timeDifference(P2_2,P2_3);
     
     	//phaseDiff = timeDiff*360/fullPeriod;
-    	sprintf(display_buffer_1, "PhaseDiff=%.2f", phaseDiff);		
+    	sprintf(display_buffer_1, "PhaseDiff=%s", Fixed_to_str(number_1, phaseDiff, 2));		
    		LCDprint(display_buffer_1, 1, 1);
     		
-   		sprintf(display_buffer_2, "V1=%.2f V2=%.2f", vmax1, vmax2);
+   		sprintf(display_buffer_2, "V1=%s V2=%s", Fixed_to_str(number_1, vmax1, 2), Fixed_to_str(number_2, vmax2, 2));
    		LCDprint(display_buffer_2, 2, 1);
     
     	
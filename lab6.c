@@ -1,6 +1,7 @@
 #include <XC.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/attribs.h>
 #include "lcd.h"
  
 // Configuration Bits (somehow XC32 takes care of this)
@@ -17,6 +18,34 @@
 // Defines
 #define SYSCLK 40000000L
 #define Baud2BRG(desired_baud)( (SYSCLK / (16*desired_baud))-1)
+#define BINARY_TELEMETRY 1 // 1: send binary frames (decoded by lab3_graph.py). 0: send text.
+
+// Serial output goes through a FIFO that the UART2 transmit interrupt empties, so printf()
+// only costs a memory copy.  When the FIFO is full new bytes are dropped and counted.
+#define TX_FIFO 512 // Must be a power of two
+
+volatile unsigned char tx_fifo[TX_FIFO];
+volatile unsigned int tx_head; // Next entry to write (main loop only)
+volatile unsigned int tx_tail; // Next entry to send (ISR only)
+volatile unsigned int tx_high_water; // Most bytes ever waiting in the FIFO
+volatile unsigned int tx_overflows;  // Bytes dropped because the FIFO was full
+
+void __ISR(_UART_2_VECTOR, IPL2SOFT) U2_Handler(void)
+{
+	while(!U2STAbits.UTXBF && (tx_tail!=tx_head)) // Fill the UART's own buffer
+	{
+		U2TXREG=tx_fifo[tx_tail];
+		tx_tail=(tx_tail+1)&(TX_FIFO-1);
+	}
+	if(tx_tail==tx_head) IEC1bits.U2TXIE=0; // Nothing left to send
+	IFS1bits.U2TXIF=0;
+}
+
+// Bytes that can still be queued
+unsigned int UART2_TX_Free(void)
+{
+	return (TX_FIFO-1)-((tx_head-tx_tail)&(TX_FIFO-1));
+}
  
 void UART2Configure(int baud_rate)
 {
@@ -29,6 +58,92 @@ void UART2Configure(int baud_rate)
     U2BRG = Baud2BRG(baud_rate); // U2BRG = (FPb / (16*baud)) - 1
     
     U2MODESET = 0x8000;     // enable UART2
+
+	// The transmit interrupt (UTXISEL=00) stays asserted while the UART's buffer has room.
+	// It is only enabled while the FIFO has something to send.
+	tx_head=0;
+	tx_tail=0;
+	tx_high_water=0;
+	tx_overflows=0;
+	IEC1bits.U2TXIE=0;
+	IFS1bits.U2TXIF=0;
+	IPC9bits.U2IP=2;
+	IPC9bits.U2IS=0;
+
+	INTCONbits.MVEC=1;
+	__builtin_enable_interrupts();
+}
+
+// Binary telemetry frame: sync byte (0xA5), channel id, sequence number, 32-bit
+// little-endian fixed point value and CRC-8 (polynomial 0x07) of the six bytes
+// between the sync byte and the CRC.  Channel ids and units are listed in lab3_graph.py.
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_PERIOD      0x20 // ns
+#define TELEMETRY_CAPACITANCE 0x21 // pF
+
+unsigned char telemetry_seq;
+
+unsigned char CRC8(unsigned char crc, unsigned char x)
+{
+	int j;
+	
+	crc^=x;
+	for(j=0; j<8; j++)
+	{
+		if(crc&0x80) crc=(crc<<1)^0x07;
+		else crc<<=1;
+	}
+	return crc;
+}
+
+// Queues one byte for UART2.  Never waits.
+void SerialTransmitByte(unsigned char x)
+{
+	unsigned int next, used;
+	
+	next=(tx_head+1)&(TX_FIFO-1);
+	if(next==tx_tail)
+	{
+		tx_overflows++;
+		return;
+	}
+	tx_fifo[tx_head]=x;
+	tx_head=next;
+	used=(tx_head-tx_tail)&(TX_FIFO-1);
+	if(used>tx_high_water) tx_high_water=used;
+	IEC1bits.U2TXIE=1;
+}
+
+// Used by printf() and puts()
+void _mon_putc(char c)
+{
+	SerialTransmitByte(c);
+}
+
+void Send_Frame(unsigned char channel, unsigned int value)
+{
+	unsigned char frame[6];
+	unsigned char crc=0;
+	int j;
+	
+	if(UART2_TX_Free()<8) // Drop the whole frame rather than send part of it
+	{
+		tx_overflows+=8;
+		return;
+	}
+	frame[0]=channel;
+	frame[1]=telemetry_seq++;
+	frame[2]=value;
+	frame[3]=value>>8;
+	frame[4]=value>>16;
+	frame[5]=value>>24;
+	SerialTransmitByte(TELEMETRY_SYNC);
+	for(j=0; j<6; j++)
+	{
+		SerialTransmitByte(frame[j]);
+		crc=CRC8(crc, frame[j]);
+	}
+	SerialTransmitByte(crc);
 }
 
 // Needed to by scanf() and gets()
@@ -40,8 +155,7 @@ int _mon_getc(int canblock)
     {
 	    while( !U2STAbits.URXDA); // wait (block) until data available in RX buffer
 	    c=U2RXREG;
-        while( U2STAbits.UTXBF);    // wait while TX buffer full
-        U2TXREG = c;          // echo
+        SerialTransmitByte(c); // echo
 	    if(c=='\r') c='\n'; // When using PUTTY, pressing <Enter> sends '\r'.  Ctrl-J sends '\n'
 		return (int)c;
     }
@@ -60,52 +174,299 @@ int _mon_getc(int canblock)
     }
 }
 
-#define PIN_PERIOD (PORTB&(1<<6))
+// Period measurement with Input Capture 1 and the 32-bit Timer2/3 pair.  The ISR stores
+// a timestamp for every rising edge of RB6 (every 16th edge above about 20kHz, using the
+// capture prescaler) in a ring buffer, so the main loop can get an averaged period at any
+// time without waiting for the signal.
+#define IC_RING 128 // Timestamps kept.  Must be a power of two.
+#define IC_FAST_TICKS (SYSCLK/20000L) // Capture every 16th edge if periods get shorter...
+#define IC_SLOW_TICKS (SYSCLK/16000L) // ...and every edge again if they get longer than this
+#define IC_STALE_TICKS (SYSCLK/2L) // No edge for 0.5s: no signal
 
-// GetPeriod() seems to work fine for frequencies between 200Hz and 700kHz.
-long int GetPeriod (int n)
+volatile unsigned int ic_ring[IC_RING]; // Timer2/3 at SYSCLK when the edges happened
+volatile unsigned int ic_head;  // Next entry to write
+volatile unsigned int ic_count; // Valid entries, up to IC_RING
+volatile unsigned int ic_edges; // Periods between consecutive entries: 1 or 16
+
+void __ISR(_INPUT_CAPTURE_1_VECTOR, IPL3SOFT) IC1_Handler(void)
 {
-	int i;
-	unsigned int saved_TCNT1a, saved_TCNT1b;
+	unsigned int t, interval;
 	
-    _CP0_SET_COUNT(0); // resets the core timer count
-	while (PIN_PERIOD!=0) // Wait for square wave to be 0
+	while(IC1CONbits.ICBNE) // Empty the capture FIFO
 	{
-		if(_CP0_GET_COUNT() > (SYSCLK/4)) return 0;
+		t=IC1BUF;
+		if(ic_count>0)
+		{
+			interval=t-ic_ring[(ic_head-1)&(IC_RING-1)];
+			// Switch the capture prescaler if needed.  The prescaler restarts when ICM
+			// changes, so the old timestamps are dropped.
+			if((ic_edges==1)&&(interval<IC_FAST_TICKS))
+			{
+				IC1CONbits.ICM=0;
+				IC1CONbits.ICM=5; // Capture every 16th rising edge
+				ic_edges=16;
+				ic_count=0;
+				continue;
+			}
+			if((ic_edges==16)&&(interval>IC_SLOW_TICKS*16))
+			{
+				IC1CONbits.ICM=0;
+				IC1CONbits.ICM=3; // Capture every rising edge
+				ic_edges=1;
+				ic_count=0;
+				continue;
+			}
+		}
+		ic_ring[ic_head]=t;
+		ic_head=(ic_head+1)&(IC_RING-1);
+		if(ic_count<IC_RING) ic_count++;
 	}
+	IFS0bits.IC1IF=0;
+}
+
+void PeriodCapture_Init(void)
+{
+	// Timer2/3 as one free running 32-bit timer at SYSCLK
+	T2CON=0;
+	T3CON=0;
+	T2CONbits.T32=1;
+	TMR2=0;
+	PR2=0xffffffff;
+	T2CONbits.ON=1;
 
-    _CP0_SET_COUNT(0); // resets the core timer count
-	while (PIN_PERIOD==0) // Wait for square wave to be 1
+	IC1Rbits.IC1R = 1; // SET RB6 to IC1 (Peripheral Pin Select)
+	ic_head=0;
+	ic_count=0;
+	ic_edges=1;
+	IC1CON=0;
+	IC1CONbits.C32=1;   // 32-bit captures from Timer2/3
+	IC1CONbits.ICTMR=1;
+	IC1CONbits.ICI=0;   // Interrupt on every capture
+	IC1CONbits.ICM=3;   // Capture every rising edge
+	IFS0bits.IC1IF=0;
+	IPC1bits.IC1IP=3;
+	IEC0bits.IC1IE=1;
+	IC1CONbits.ON=1;
+
+	INTCONbits.MVEC=1;
+	__builtin_enable_interrupts();
+}
+
+// Gets the time of up to 'n' periods from the latest timestamps without waiting.
+// Returns how many periods were actually used (0 if there is no signal yet) and
+// stores their total duration in Timer2/3 ticks in *ticks.
+int PeriodCapture_Get(int n, unsigned int * ticks)
+{
+	unsigned int last, first, count, edges, steps;
+
+	IEC0bits.IC1IE=0; // Keep the ISR from changing the ring while we read it
+	count=ic_count;
+	edges=ic_edges;
+	last=ic_ring[(ic_head-1)&(IC_RING-1)];
+	steps=(n+edges-1)/edges; // Ring entries needed to cover 'n' periods
+	if(count>0 && steps>count-1) steps=count-1;
+	first=ic_ring[(ic_head-1-steps)&(IC_RING-1)];
+	if(count>0 && (TMR2-last)>IC_STALE_TICKS)
 	{
-		if(_CP0_GET_COUNT() > (SYSCLK/4)) return 0;
+		ic_count=0; // The signal went away
+		count=0;
 	}
-	
-    _CP0_SET_COUNT(0); // resets the core timer count
-	for(i=0; i<n; i++) // Measure the time of 'n' periods
+	IEC0bits.IC1IE=1;
+
+	if(count<2) return 0;
+	*ticks=last-first;
+	return steps*edges;
+}
+
+// Adaptive averaging: average just enough periods for PERIOD_RESOLUTION timer ticks (one
+// tick of error is then 1 part in PERIOD_RESOLUTION), but never more signal than
+// PERIOD_BUDGET_MS, so readings stay fresh from 200Hz to 700kHz.
+#define PERIOD_BUDGET_MS 100
+#define PERIOD_RESOLUTION 100000L
+
+// Like PeriodCapture_Get() but picks the number of periods itself from the length of
+// the latest period.  Returns the number of periods used, 0 if there is no signal.
+int PeriodCapture_Adaptive(unsigned int * ticks)
+{
+	unsigned int one;
+	int used, n, n_budget;
+
+	used=PeriodCapture_Get(1, &one); // One period, or 16 if the prescaler is on
+	if(used==0) return 0;
+	one/=used;
+	if(one==0) one=1;
+
+	n=(PERIOD_RESOLUTION+one-1)/one;
+	n_budget=(SYSCLK/1000L*PERIOD_BUDGET_MS)/one;
+	if(n>n_budget) n=n_budget;
+	if(n<1) n=1;
+	return PeriodCapture_Get(n, ticks);
+}
+
+// Cooperative scheduler.  The core timer (SYSCLK/2) interrupts every millisecond and
+// counts tick_ms.  The main loop runs each task when its period comes around.  Tasks
+// run to completion and never wait, so a slow one (the LCD) only delays the others
+// for a moment instead of setting the pace for all of them.
+#define CORE_TICKS_PER_MS (SYSCLK/2000L)
+
+volatile unsigned int tick_ms; // Milliseconds since Tick_Init()
+
+void __ISR(_CORE_TIMER_VECTOR, IPL1SOFT) CoreTimer_Handler(void)
+{
+	unsigned int next;
+
+	next=_CP0_GET_COMPARE()+CORE_TICKS_PER_MS;
+	if((int)(_CP0_GET_COUNT()-next)>=0) next=_CP0_GET_COUNT()+CORE_TICKS_PER_MS; // Fell behind
+	_CP0_SET_COMPARE(next);
+	tick_ms++;
+	IFS0bits.CTIF=0;
+}
+
+void Tick_Init(void)
+{
+	tick_ms=0;
+	_CP0_SET_COMPARE(_CP0_GET_COUNT()+CORE_TICKS_PER_MS);
+	IFS0bits.CTIF=0;
+	IPC0bits.CTIP=1; // Lowest priority: the UART and the input capture come first
+	IPC0bits.CTIS=0;
+	IEC0bits.CTIE=1;
+}
+
+struct task
+{
+	void (*run)(void);
+	unsigned int period_ms;
+	unsigned int next;  // tick_ms when it is due again
+	unsigned int worst; // Longest run so far, in core timer ticks
+};
+
+// The latest reading, from Measure_Task()
+int periods; // 0 until there is a signal
+float T, capacitance; // Seconds, uF
+unsigned char reading_shown; // Range_Task() already formatted this reading
+unsigned char reading_sent;  // Console_Task() already printed this reading
+
+char display_buffer_1[17];
+char display_buffer_2[17];
+unsigned char lcd_line; // Line LCD_Task() refreshes next
+
+void Measure_Task(void)
+{
+	unsigned int ticks;
+	unsigned int period_ns;
+	int n;
+
+	n=PeriodCapture_Adaptive(&ticks);
+	if(n==0) return; // No signal: keep the last reading on the LCD
+	periods=n;
+	T=ticks/((float)SYSCLK*n);
+#if (BINARY_TELEMETRY==1)
+	period_ns=((unsigned long long)ticks*1000000000ULL)/((unsigned long long)SYSCLK*n);
+	Send_Frame(TELEMETRY_PERIOD, period_ns);
+	// C=1.44*T/(RA+2*RB)
+	Send_Frame(TELEMETRY_CAPACITANCE, ((unsigned long long)period_ns*1440ULL)/(RA+2*RB));
+#endif
+	capacitance = 1.44*T/(RA+2*RB);
+	capacitance*=1000000;
+	reading_shown=0;
+	reading_sent=0;
+}
+
+// Picks the units for the LCD
+void Range_Task(void)
+{
+	float c;
+
+	if(periods==0 || reading_shown) return;
+	reading_shown=1;
+	c=capacitance;
+	sprintf(display_buffer_1,"Capacitance");
+	if(c<0.01&&c>0.001){
+		c*=1000;
+		c-=0.47;
+		sprintf(display_buffer_2,"C= %.2fnF", c);
+	}else if(c<0.02&&c>0.091){
+		c*=1000;
+		//c-=0.63;
+		sprintf(display_buffer_2,"C= %.2fnF", c);
+	}else if(c<0.001){
+		sprintf(display_buffer_2,"NO capacitor");
+	}else{
+		sprintf(display_buffer_2,"C= %.2fuF", c);
+	}
+}
+
+// One line per run: LCDprint() waits about 40us per changed character
+void LCD_Task(void)
+{
+	if(display_buffer_1[0]==0) return; // Nothing measured yet
+	if(lcd_line==0)
+		LCDprint(display_buffer_1,1,1);
+	else
+		LCDprint(display_buffer_2,2,1);
+	lcd_line^=1;
+}
+
+void Console_Task(void);
+
+struct task tasks[]=
+{
+	{Measure_Task, 20},  // Readings (and telemetry frames) at 50Hz
+	{Range_Task,  100},
+	{LCD_Task,     50},  // Each line every 100ms
+	{Console_Task, 200},
+};
+#define TASKS (sizeof(tasks)/sizeof(tasks[0]))
+#define TASK_WORST_US(i) ((unsigned int)(tasks[i].worst/(SYSCLK/2000000L)))
+
+void Console_Task(void)
+{
+#if (BINARY_TELEMETRY==0)
+	if(periods>0 && !reading_sent)
 	{
-		while (PIN_PERIOD!=0) // Wait for square wave to be 0
-		{
-			if(_CP0_GET_COUNT() > (SYSCLK/4)) return 0;
-		}
-		while (PIN_PERIOD==0) // Wait for square wave to be 1
-		{
-			if(_CP0_GET_COUNT() > (SYSCLK/4)) return 0;
-		}
+		reading_sent=1;
+		printf("T: %f, C: %f, N: %d, TX: %u/%u lost: %u, run: %u/%u/%u/%uus\r",T,capacitance*1000000,periods,
+		       tx_high_water, TX_FIFO-1, tx_overflows,
+		       TASK_WORST_US(0), TASK_WORST_US(1), TASK_WORST_US(2), TASK_WORST_US(3));
 	}
+#endif
+	fflush(stdout); // GCC peculiarities: need to flush stdout to get string out without a '\n'
+}
+
+void Scheduler_Init(void)
+{
+	int i;
+
+	for(i=0; i<TASKS; i++) tasks[i].next=tick_ms;
+}
+
+// Runs the due tasks once, in table order.  A task that falls a whole period behind
+// skips the missed runs instead of running several times in a row.
+void Scheduler_Poll(void)
+{
+	int i;
+	unsigned int start, took;
+
+	for(i=0; i<TASKS; i++)
+	{
+		if((int)(tick_ms-tasks[i].next)<0) continue;
+		tasks[i].next+=tasks[i].period_ms;
+		if((int)(tick_ms-tasks[i].next)>=0) tasks[i].next=tick_ms+tasks[i].period_ms;
+		start=_CP0_GET_COUNT();
+		tasks[i].run();
+		took=_CP0_GET_COUNT()-start;
+		if(took>tasks[i].worst) tasks[i].worst=took;
+	}
+}
 
-	return  _CP0_GET_COUNT();
+void Scheduler_Run(void)
+{
+	Scheduler_Init();
+	while(1) Scheduler_Poll();
 }
+
 void main(void)
 {
-    char buff[17];
-    int j;
-	long int count;
-	float T, f,capacitance;
-	
-	char display_buffer_1[17];
-	
-	char display_buffer_2[17];
-	
 	DDPCON = 0;
 	CFGCON = 0;
 
@@ -119,81 +480,14 @@ void main(void)
     CNPUB |= (1<<6);   // Enable pull-up resistor for RB6
 
 	waitms(500);	
+#if (BINARY_TELEMETRY==0)
 	printf("4-bit mode LCD Test using the PIC32MX130.\r\n");
+#endif
 		
    	// Display something in the LCD
 	LCDprint("Capacitance", 1, 1);
 	//LCDprint("TEST", 2, 1);
-	while(1)
-	{
-		//printf("Type what you want to display in line 2 (16 char max): ");
-		count=GetPeriod(100);
-		
-		if(count>0)
-		{
-	
-			T=(count*2.0)/(SYSCLK*100.0);
-	
-			capacitance = 1.44*T/(RA+2*RB);
-
-			capacitance*=1000000;
-			
-			if(capacitance<0.01&&capacitance>0.001){
-				capacitance*=1000;
-				capacitance-=0.47;
-				
-				sprintf(display_buffer_1,"Capacitance");
-			
-				sprintf(display_buffer_2,"C= %.2fnF", capacitance);
-			
-				LCDprint(display_buffer_1,1,1);
-				LCDprint(display_buffer_2,2,1);
-			}else if(capacitance<0.02&&capacitance>0.091){
-				capacitance*=1000;
-				//capacitance-=0.63;
-				
-				sprintf(display_buffer_1,"Capacitance");
-			
-				sprintf(display_buffer_2,"C= %.2fnF", capacitance);
-			
-				LCDprint(display_buffer_1,1,1);
-				LCDprint(display_buffer_2,2,1);
-			}else if(capacitance<0.001){
-				sprintf(display_buffer_1,"Capacitance");
-			
-				sprintf(display_buffer_2,"NO capacitor");
-			
-				LCDprint(display_buffer_1,1,1);
-				LCDprint(display_buffer_2,2,1);
-			}else{
-				sprintf(display_buffer_1,"Capacitance");
-
-				sprintf(display_buffer_2,"C= %.2fuF", capacitance);
-			
-				LCDprint(display_buffer_1,1,1);
-				LCDprint(display_buffer_2,2,1);
-			}
-			printf("T: %f, C: %f\r",T,capacitance*1000000);
-			
-			//sprintf(display_buffer_1,"Capacitance");
-			
-			//sprintf(display_buffer_2,"C= %.4fF", capacitance*1000000);
-			
-			//LCDprint(display_buffer_1,1,1);
-		
-			//LCDprint(display_buffer_2,2,1);
-		}
-		
-		fflush(stdout); // GCC peculiarities: need to flush stdout to get string out without a '\n'
-		//fgets(buff, sizeof(buff)-1, stdin);	
-		//printf("\r\n");
-		//for(j=0; j<sizeof(buff); j++)
-		//{
-		//	if(buff[j]=='\r') buff[j]=0;
-		//	if(buff[j]=='\n') buff[j]=0;
-		//}
-
-		//LCDprint(buff, 2, 1);
-		waitms(200);
-	}
+	PeriodCapture_Init();
+	Tick_Init();
+	Scheduler_Run();
 }
@@ -67,7 +67,7 @@ void WriteData(unsigned char x)
 {
 	LCD_RS = 1;
 	LCD_byte(x);
-	waitms(2);
+	Timer4us(40); // Data writes take 37us to execute (HD44780 data sheet)
 }
 
 void WriteCommand(unsigned char x)
@@ -77,8 +77,22 @@ void WriteCommand(unsigned char x)
 	waitms(5);
 }
 
+// Shadow copy of what the LCD is showing, so only the cells that change are sent
+static char lcd_shadow[2][CHARS_PER_LINE];
+static unsigned char lcd_cursor; // DDRAM address of the LCD cursor
+
+static void LCD_goto(unsigned char addr)
+{
+	LCD_RS = 0;
+	LCD_byte(0x80|addr); // Set DDRAM address command
+	Timer4us(40); // Also 37us to execute
+	lcd_cursor = addr;
+}
+
 void LCD_4BIT(void)
 {
+	int j;
+
 	// Configure the pins used to communicate with the LCD as outputs
 	LCD_RS_ENABLE = 0;
 	LCD_E_ENABLE = 0;
@@ -100,18 +114,41 @@ void LCD_4BIT(void)
 	WriteCommand(0x0c);
 	WriteCommand(0x01); // Clear screen command (takes some time)
 	waitms(20); // Wait for clear screen command to finish
+	for(j=0;j<CHARS_PER_LINE;j++)
+	{
+		lcd_shadow[0][j] = ' ';
+		lcd_shadow[1][j] = ' ';
+	}
+	lcd_cursor = 0; // Clear screen also moves the cursor home
 	LATBbits.LATB0 = 	!LATBbits.LATB0;
 }
 
+// Only the characters that differ from what the LCD is already showing are sent.
+// The cursor address is only set when the next changed cell is not where the
+// cursor already is.
 void LCDprint(char * string, unsigned char line, unsigned char clear)
 {
 	int j;
+	unsigned char addr;
+	char c;
+	char * shown;
 	
-	WriteCommand(line==2?0xc0:0x80);
-	waitms(5);
-	for(j=0;string[j]!=0;j++)
-		WriteData(string[j]); //Write the message character by character
-	if(clear)
-		for(;j<CHARS_PER_LINE;j++)
-			WriteData(' '); //Clear the rest of the line if clear is 1
+	shown = lcd_shadow[line==2?1:0];
+	addr = line==2?0x40:0x00;
+	for(j=0;j<CHARS_PER_LINE;j++,addr++)
+	{
+		if(*string)
+			c = *string++;
+		else if(clear)
+			c = ' '; //Clear the rest of the line if clear is 1
+		else
+			break;
+		if(shown[j]==c)
+			continue; //Already showing
+		if(lcd_cursor!=addr)
+			LCD_goto(addr);
+		WriteData(c);
+		shown[j] = c;
+		lcd_cursor++; //The LCD moves the cursor right after each write
+	}
 }
\ No newline at end of file
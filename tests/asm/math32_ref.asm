@@ -0,0 +1,250 @@
+; Reference routines for the cycle comparisons in the simulator tests, standing in for
+; math32.inc, which is not in this tree.  Same names and registers (x and y, 32 bits,
+; result in x), written the usual 8051 way: MUL AB partial products for mul32 and one
+; bit at a time for div32.  Treat the cycle counts as an estimate of the library's.
+
+DSEG at 30H
+x:   ds 4
+y:   ds 4
+z:   ds 4 ; Scratch
+bcd: ds 5
+
+CSEG
+
+; x = x*y, low 32 bits
+mul32:
+	push acc
+	push b
+	push AR0
+	push AR1
+	push AR2
+	push AR3
+	mov a, x+0
+	mov b, y+0
+	mul ab
+	mov R0, a
+	mov R1, b
+	mov R2, #0
+	mov R3, #0
+	; Byte 1: x1*y0 and x0*y1
+	mov a, x+1
+	mov b, y+0
+	mul ab
+	add a, R1
+	mov R1, a
+	mov a, b
+	addc a, R2
+	mov R2, a
+	clr a
+	addc a, R3
+	mov R3, a
+	mov a, x+0
+	mov b, y+1
+	mul ab
+	add a, R1
+	mov R1, a
+	mov a, b
+	addc a, R2
+	mov R2, a
+	clr a
+	addc a, R3
+	mov R3, a
+	; Byte 2: x2*y0, x1*y1 and x0*y2
+	mov a, x+2
+	mov b, y+0
+	mul ab
+	add a, R2
+	mov R2, a
+	mov a, b
+	addc a, R3
+	mov R3, a
+	mov a, x+1
+	mov b, y+1
+	mul ab
+	add a, R2
+	mov R2, a
+	mov a, b
+	addc a, R3
+	mov R3, a
+	mov a, x+0
+	mov b, y+2
+	mul ab
+	add a, R2
+	mov R2, a
+	mov a, b
+	addc a, R3
+	mov R3, a
+	; Byte 3: only the low bytes of x3*y0, x2*y1, x1*y2 and x0*y3
+	mov a, x+3
+	mov b, y+0
+	mul ab
+	add a, R3
+	mov R3, a
+	mov a, x+2
+	mov b, y+1
+	mul ab
+	add a, R3
+	mov R3, a
+	mov a, x+1
+	mov b, y+2
+	mul ab
+	add a, R3
+	mov R3, a
+	mov a, x+0
+	mov b, y+3
+	mul ab
+	add a, R3
+	mov R3, a
+	mov x+0, R0
+	mov x+1, R1
+	mov x+2, R2
+	mov x+3, R3
+	pop AR3
+	pop AR2
+	pop AR1
+	pop AR0
+	pop b
+	pop acc
+	ret
+
+; x = x/y, unsigned.  The remainder is kept in [R7, R6, R5, R4].
+div32:
+	push acc
+	push AR2
+	push AR4
+	push AR5
+	push AR6
+	push AR7
+	clr a
+	mov R4, a
+	mov R5, a
+	mov R6, a
+	mov R7, a
+	mov R2, #32
+div32_loop:
+	; Shift [remainder, x] left one bit
+	clr c
+	mov a, x+0
+	rlc a
+	mov x+0, a
+	mov a, x+1
+	rlc a
+	mov x+1, a
+	mov a, x+2
+	rlc a
+	mov x+2, a
+	mov a, x+3
+	rlc a
+	mov x+3, a
+	mov a, R4
+	rlc a
+	mov R4, a
+	mov a, R5
+	rlc a
+	mov R5, a
+	mov a, R6
+	rlc a
+	mov R6, a
+	mov a, R7
+	rlc a
+	mov R7, a
+	; If y fits, take it off and set the quotient bit
+	clr c
+	mov a, R4
+	subb a, y+0
+	mov z+0, a
+	mov a, R5
+	subb a, y+1
+	mov z+1, a
+	mov a, R6
+	subb a, y+2
+	mov z+2, a
+	mov a, R7
+	subb a, y+3
+	jc div32_next
+	mov R7, a
+	mov R6, z+2
+	mov R5, z+1
+	mov R4, z+0
+	orl x+0, #1
+div32_next:
+	djnz R2, div32_loop
+	pop AR7
+	pop AR6
+	pop AR5
+	pop AR4
+	pop AR2
+	pop acc
+	ret
+
+; x = x-y
+sub32:
+	push acc
+	clr c
+	mov a, x+0
+	subb a, y+0
+	mov x+0, a
+	mov a, x+1
+	subb a, y+1
+	mov x+1, a
+	mov a, x+2
+	subb a, y+2
+	mov x+2, a
+	mov a, x+3
+	subb a, y+3
+	mov x+3, a
+	pop acc
+	ret
+
+; x to ten packed BCD digits in bcd, one bit of x at a time: bcd = bcd*2 + bit with DA
+hex2bcd:
+	push acc
+	push AR2
+	clr a
+	mov bcd+0, a
+	mov bcd+1, a
+	mov bcd+2, a
+	mov bcd+3, a
+	mov bcd+4, a
+	mov R2, #32
+hex2bcd_loop:
+	mov a, x+3 ; Top bit of x to the carry, x is rotated back in place after 32 bits
+	rlc a
+	mov a, x+0
+	rlc a
+	mov x+0, a
+	mov a, x+1
+	rlc a
+	mov x+1, a
+	mov a, x+2
+	rlc a
+	mov x+2, a
+	mov a, x+3
+	rlc a
+	mov x+3, a
+	mov a, bcd+0
+	addc a, bcd+0
+	da a
+	mov bcd+0, a
+	mov a, bcd+1
+	addc a, bcd+1
+	da a
+	mov bcd+1, a
+	mov a, bcd+2
+	addc a, bcd+2
+	da a
+	mov bcd+2, a
+	mov a, bcd+3
+	addc a, bcd+3
+	da a
+	mov bcd+3, a
+	mov a, bcd+4
+	addc a, bcd+4
+	da a
+	mov bcd+4, a
+	djnz R2, hex2bcd_loop
+	pop AR2
+	pop acc
+	ret
+
+END
@@ -0,0 +1,79 @@
+// Host stand-in for the SDCC <EFM8LB1.h>: the registers lab4.c and lab5.c use, as plain
+// variables.  The SDCC keywords go away (bit becomes a byte, xdata and code are dropped or
+// become const), and the Makefile strips the 'interrupt' clauses and the 0b_ separators
+// before gcc sees the source.  See efm8_mock.c, which also runs Timer 3.
+#ifndef MOCK_EFM8LB1_H
+#define MOCK_EFM8LB1_H
+
+#define bit unsigned char
+#define xdata
+#define idata
+#define data
+#define code const
+#define reentrant
+
+#ifndef MOCK_SFR
+#define MOCK_SFR(n) extern volatile unsigned char n
+#define MOCK_SFR16(n) extern volatile unsigned int n
+#endif
+
+// System
+MOCK_SFR(SFRPAGE); MOCK_SFR(WDTCN); MOCK_SFR(PFE0CN); MOCK_SFR(CLKSEL); MOCK_SFR(VDM0CN); MOCK_SFR(RSTSRC);
+MOCK_SFR(ACC); MOCK_SFR(ACC_0); MOCK_SFR(ACC_1); MOCK_SFR(ACC_2); MOCK_SFR(ACC_3);
+MOCK_SFR(ACC_4); MOCK_SFR(ACC_5); MOCK_SFR(ACC_6); MOCK_SFR(ACC_7);
+
+// Ports and crossbar
+MOCK_SFR(P0MDOUT); MOCK_SFR(P0MDIN); MOCK_SFR(P1MDIN); MOCK_SFR(P2MDIN);
+MOCK_SFR(P0SKIP); MOCK_SFR(P1SKIP); MOCK_SFR(P2SKIP); MOCK_SFR(XBR0); MOCK_SFR(XBR1); MOCK_SFR(XBR2);
+MOCK_SFR(P0_1); MOCK_SFR(P0_2); MOCK_SFR(P0_3); MOCK_SFR(P0_6); MOCK_SFR(P0_7);
+MOCK_SFR(P1_0); MOCK_SFR(P1_1); MOCK_SFR(P1_2); MOCK_SFR(P1_3); MOCK_SFR(P1_7);
+MOCK_SFR(P2_0); MOCK_SFR(P2_1); MOCK_SFR(P2_2);
+
+// UART0 and Timer 1
+MOCK_SFR(SCON0); MOCK_SFR(SBUF0); MOCK_SFR(TI);
+MOCK_SFR(CKCON0); MOCK_SFR(TMOD); MOCK_SFR(TH1); MOCK_SFR(TL1); MOCK_SFR(TR1);
+
+// Timers 0, 2, 3, 4 and 5
+MOCK_SFR(TH0); MOCK_SFR(TL0); MOCK_SFR(TR0); MOCK_SFR(TF0);
+MOCK_SFR(TMR2CN0); MOCK_SFR(TMR2H); MOCK_SFR(TMR2L); MOCK_SFR(TF2H); MOCK_SFR(TR2);
+MOCK_SFR(TMR3CN0);
+MOCK_SFR(TMR4CN0); MOCK_SFR(TMR5CN0);
+MOCK_SFR16(TMR2RL); MOCK_SFR16(TMR2); MOCK_SFR16(TMR3RL); MOCK_SFR16(TMR3);
+
+// Timer 3 runs in simulated time (efm8_mock.c): reading it moves it on
+unsigned char Mock_TMR3H(void);
+unsigned char Mock_TMR3L(void);
+#define TMR3H Mock_TMR3H()
+#define TMR3L Mock_TMR3L()
+
+// Every use of EIE1 first runs the Timer 3 interrupt if it is pending and enabled: on
+// the chip it would have run as soon as the code enabled it
+extern volatile unsigned char mock_eie1[1];
+int Mock_Interrupts(void);
+#define EIE1 mock_eie1[Mock_Interrupts()]
+
+// Interrupts
+MOCK_SFR(IE); MOCK_SFR(IP); MOCK_SFR(IPH); MOCK_SFR(EIE2); MOCK_SFR(EIP1); MOCK_SFR(EIP1H);
+MOCK_SFR(EA); MOCK_SFR(ET0); MOCK_SFR(ET2); MOCK_SFR(PT0); MOCK_SFR(PT2);
+
+// ADC
+MOCK_SFR(ADEN); MOCK_SFR(ADINT); MOCK_SFR(ADBUSY); MOCK_SFR(ADWINT); MOCK_SFR(ADC0MX);
+MOCK_SFR(ADC0CN0); MOCK_SFR(ADC0CN1); MOCK_SFR(ADC0CN2); MOCK_SFR(ADC0CF0); MOCK_SFR(ADC0CF1); MOCK_SFR(ADC0CF2);
+MOCK_SFR(ADC0H); MOCK_SFR(ADC0L); MOCK_SFR(ADC0GTH); MOCK_SFR(ADC0GTL); MOCK_SFR(ADC0LTH); MOCK_SFR(ADC0LTL);
+MOCK_SFR16(ADC0); MOCK_SFR16(ADC0GT); MOCK_SFR16(ADC0LT);
+
+// PCA
+MOCK_SFR(PCA0MD); MOCK_SFR(PCA0CN0); MOCK_SFR(PCA0CLR); MOCK_SFR(PCA0POL); MOCK_SFR(PCA0PWM); MOCK_SFR(PCA0CENT);
+MOCK_SFR(CR); MOCK_SFR(CF); MOCK_SFR(CCF0); MOCK_SFR(CCF1); MOCK_SFR(CCF2);
+MOCK_SFR(PCA0CPM0); MOCK_SFR(PCA0CPM1); MOCK_SFR(PCA0CPM2);
+MOCK_SFR(PCA0L); MOCK_SFR(PCA0H); MOCK_SFR(PCA0CPL0); MOCK_SFR(PCA0CPH0);
+MOCK_SFR(PCA0CPL1); MOCK_SFR(PCA0CPH1); MOCK_SFR(PCA0CPL2); MOCK_SFR(PCA0CPH2);
+MOCK_SFR16(PCA0); MOCK_SFR16(PCA0CP0); MOCK_SFR16(PCA0CP1); MOCK_SFR16(PCA0CP2);
+
+// ADC mux inputs
+#define QFP32_MUX_P2_1 0x0e
+#define QFP32_MUX_P2_2 0x0f
+#define QFP32_MUX_P2_3 0x10
+#define QFP32_MUX_P2_4 0x11
+
+#endif
@@ -0,0 +1,62 @@
+// Host stand-in for the XC32 <XC.h>: just the PIC32MX130 registers that lab6.c and lcd.c
+// use.  Plain registers are variables.  The timers (TMR2, TMR4 and the core timer) are
+// worked out from mock_cycles, the simulated SYSCLK count, which every read advances a
+// little, so the busy waits in the firmware end.  See pic32_mock.c.
+#ifndef MOCK_XC_H
+#define MOCK_XC_H
+
+extern unsigned long long mock_cycles; // SYSCLK cycles since reset
+void mock_advance(unsigned long cycles);
+
+extern volatile unsigned int T2CON, T3CON, PR2, T4CON, T4CONCLR;
+extern volatile unsigned int IC1CON, IC1BUF, IC1R;
+extern volatile unsigned int U2MODE, U2MODESET, U2STA, U2BRG, U2RXREG, U2TXREG;
+extern volatile unsigned int PORTB, LATB, TRISB, ANSELB, CNPUB, DDPCON, CFGCON;
+
+volatile unsigned int * mock_TMR2(void);
+volatile unsigned int * mock_TMR4(void);
+#define TMR2 (*mock_TMR2())
+#define TMR4 (*mock_TMR4())
+
+typedef struct { unsigned T32:1, ON:1; } __T2CONbits_t;
+extern volatile __T2CONbits_t T2CONbits;
+typedef struct { unsigned ICBNE:1, ICM:3, C32:1, ICTMR:1, ICI:2, ON:1; } __IC1CONbits_t;
+extern volatile __IC1CONbits_t IC1CONbits;
+typedef struct { unsigned IC1R:4; } __IC1Rbits_t;
+extern volatile __IC1Rbits_t IC1Rbits;
+typedef struct { unsigned URXDA:1, UTXBF:1, TRMT:1, OERR:1; } __U2STAbits_t;
+extern volatile __U2STAbits_t U2STAbits;
+typedef struct { unsigned U2RXR:4; } __U2RXRbits_t;
+extern volatile __U2RXRbits_t U2RXRbits;
+typedef struct { unsigned RPB9R:4; } __RPB9Rbits_t;
+extern volatile __RPB9Rbits_t RPB9Rbits;
+typedef struct { unsigned LATB0:1; } __LATBbits_t;
+extern volatile __LATBbits_t LATBbits;
+typedef struct { unsigned CTIF:1, IC1IF:1; } __IFS0bits_t;
+extern volatile __IFS0bits_t IFS0bits;
+typedef struct { unsigned CTIE:1, IC1IE:1; } __IEC0bits_t;
+extern volatile __IEC0bits_t IEC0bits;
+typedef struct { unsigned U2TXIF:1; } __IFS1bits_t;
+extern volatile __IFS1bits_t IFS1bits;
+typedef struct { unsigned U2TXIE:1; } __IEC1bits_t;
+extern volatile __IEC1bits_t IEC1bits;
+typedef struct { unsigned CTIP:3, CTIS:2; } __IPC0bits_t;
+extern volatile __IPC0bits_t IPC0bits;
+typedef struct { unsigned IC1IP:3; } __IPC1bits_t;
+extern volatile __IPC1bits_t IPC1bits;
+typedef struct { unsigned U2IP:3, U2IS:2; } __IPC9bits_t;
+extern volatile __IPC9bits_t IPC9bits;
+typedef struct { unsigned MVEC:1; } __INTCONbits_t;
+extern volatile __INTCONbits_t INTCONbits;
+
+// The core timer counts at SYSCLK/2
+unsigned int _CP0_GET_COUNT(void);
+void _CP0_SET_COUNT(unsigned int count);
+unsigned int _CP0_GET_COMPARE(void);
+void _CP0_SET_COMPARE(unsigned int compare);
+
+extern int mock_interrupts_enabled;
+#define __builtin_enable_interrupts() (mock_interrupts_enabled=1)
+#define __builtin_disable_interrupts() (mock_interrupts_enabled=0)
+
+#endif
@@ -0,0 +1,58 @@
+// The EFM8LB1 registers for the host tests: the same list as EFM8LB1.h, defined here.
+// Timer 3 runs in simulated time: every read of TMR3H or TMR3L moves it on by
+// mock_tmr3_step counts, about what the code around the read would take.  On overflow it
+// reloads from TMR3RL and sets TF3H, and the firmware's Timer3_ISR() runs at the next
+// read, or the next use of EIE1, with EA and ET3 (EIE1 bit 7) set.
+#define MOCK_SFR(n) volatile unsigned char n
+#define MOCK_SFR16(n) volatile unsigned int n
+#include <EFM8LB1.h>
+
+void Timer3_ISR(void);
+
+unsigned int mock_tmr3_step=4;
+unsigned long long mock_tmr3_counts; // Timer 3 counts since the test started
+
+volatile unsigned char mock_eie1[1];
+
+int Mock_Interrupts(void)
+{
+	static int in_isr;
+
+	if(EA && (mock_eie1[0]&0x80) && (TMR3CN0&0x80) && !in_isr)
+	{
+		in_isr=1;
+		Timer3_ISR();
+		in_isr=0;
+	}
+	return 0;
+}
+
+static void Timer3_Run(void)
+{
+	unsigned long t;
+
+	if(TMR3CN0&0x04) // TR3
+	{
+		mock_tmr3_counts+=mock_tmr3_step;
+		t=(TMR3&0xffff)+mock_tmr3_step;
+		while(t>0xffff)
+		{
+			t=t-0x10000+(TMR3RL&0xffff);
+			TMR3CN0|=0x80; // TF3H
+		}
+		TMR3=t;
+	}
+	Mock_Interrupts();
+}
+
+unsigned char Mock_TMR3H(void)
+{
+	Timer3_Run();
+	return (TMR3>>8)&0xff;
+}
+
+unsigned char Mock_TMR3L(void)
+{
+	Timer3_Run();
+	return TMR3&0xff;
+}
@@ -0,0 +1,21 @@
+// Host stand-in for the board's lcd.h: the LCD pins are variables, which the HD44780
+// model in the tests samples while E is high.
+#ifndef MOCK_LCD_H
+#define MOCK_LCD_H
+
+#define SYSCLK 40000000L
+#define CHARS_PER_LINE 16
+
+extern volatile int LCD_RS, LCD_E, LCD_D4, LCD_D5, LCD_D6, LCD_D7;
+extern volatile int LCD_RS_ENABLE, LCD_E_ENABLE, LCD_D4_ENABLE, LCD_D5_ENABLE, LCD_D6_ENABLE, LCD_D7_ENABLE;
+
+void Timer4us(unsigned char t);
+void waitms(unsigned int ms);
+void LCD_pulse(void);
+void LCD_byte(unsigned char x);
+void WriteData(unsigned char x);
+void WriteCommand(unsigned char x);
+void LCD_4BIT(void);
+void LCDprint(char * string, unsigned char line, unsigned char clear);
+
+#endif
@@ -0,0 +1,108 @@
+// Simulated time and the PIC32 registers for the host tests.  Every timer read costs a
+// few cycles, and whenever time moves the test's mock_hook() gets a look: that is where
+// the tests sample the LCD pins, feed input edges and run the interrupt handlers.
+#include <XC.h>
+#include "lcd.h"
+
+#define READ_CYCLES 4 // SYSCLK cycles charged for each timer read
+
+unsigned long long mock_cycles;
+int mock_interrupts_enabled;
+void (*mock_hook)(void);
+
+volatile unsigned int T2CON, T3CON, PR2, T4CON, T4CONCLR;
+volatile unsigned int IC1CON, IC1BUF, IC1R;
+volatile unsigned int U2MODE, U2MODESET, U2STA, U2BRG, U2RXREG, U2TXREG;
+volatile unsigned int PORTB, LATB, TRISB, ANSELB, CNPUB, DDPCON, CFGCON;
+
+volatile __T2CONbits_t T2CONbits;
+volatile __IC1CONbits_t IC1CONbits;
+volatile __IC1Rbits_t IC1Rbits;
+volatile __U2STAbits_t U2STAbits;
+volatile __U2RXRbits_t U2RXRbits;
+volatile __RPB9Rbits_t RPB9Rbits;
+volatile __LATBbits_t LATBbits;
+volatile __IFS0bits_t IFS0bits;
+volatile __IEC0bits_t IEC0bits;
+volatile __IFS1bits_t IFS1bits;
+volatile __IEC1bits_t IEC1bits;
+volatile __IPC0bits_t IPC0bits;
+volatile __IPC1bits_t IPC1bits;
+volatile __IPC9bits_t IPC9bits;
+volatile __INTCONbits_t INTCONbits;
+
+volatile int LCD_RS, LCD_E, LCD_D4, LCD_D5, LCD_D6, LCD_D7;
+volatile int LCD_RS_ENABLE, LCD_E_ENABLE, LCD_D4_ENABLE, LCD_D5_ENABLE, LCD_D6_ENABLE, LCD_D7_ENABLE;
+
+static unsigned int cp0_offset, cp0_compare;
+
+static unsigned int core_count(void)
+{
+	return (unsigned int)(mock_cycles/2)+cp0_offset;
+}
+
+void mock_advance(unsigned long cycles)
+{
+	static int in_hook;
+	unsigned int before;
+
+	before=core_count();
+	mock_cycles+=cycles;
+	if((unsigned int)(cp0_compare-before-1)<(unsigned int)(core_count()-before))
+		IFS0bits.CTIF=1; // The count went past the compare value
+	if(mock_hook && !in_hook)
+	{
+		in_hook=1;
+		mock_hook();
+		in_hook=0;
+	}
+}
+
+unsigned int _CP0_GET_COUNT(void)
+{
+	mock_advance(READ_CYCLES);
+	return core_count();
+}
+
+void _CP0_SET_COUNT(unsigned int count)
+{
+	cp0_offset=count-(unsigned int)(mock_cycles/2);
+}
+
+unsigned int _CP0_GET_COMPARE(void)
+{
+	return cp0_compare;
+}
+
+void _CP0_SET_COMPARE(unsigned int compare)
+{
+	cp0_compare=compare;
+}
+
+// A timer register: catches up with the time that went by since it was last looked at.
+// Writes through the returned pointer set it.
+struct mock_timer
+{
+	unsigned int value;
+	unsigned long long last;
+};
+
+static volatile unsigned int * timer_read(struct mock_timer * t, int running)
+{
+	mock_advance(READ_CYCLES);
+	if(running) t->value+=(unsigned int)(mock_cycles-t->last);
+	t->last=mock_cycles;
+	return &t->value;
+}
+
+volatile unsigned int * mock_TMR2(void)
+{
+	static struct mock_timer tmr2;
+	return timer_read(&tmr2, T2CONbits.ON); // 32-bit Timer2/3 at SYSCLK
+}
+
+volatile unsigned int * mock_TMR4(void)
+{
+	static struct mock_timer tmr4;
+	return timer_read(&tmr4, T4CON&0x8000); // 1:1 prescaler
+}
@@ -0,0 +1,12 @@
+// Host stand-in for the XC32 <sys/attribs.h>: interrupt handlers become plain functions,
+// which the tests call from the mock_interrupts() hook in pic32_mock.c.
+#ifndef MOCK_ATTRIBS_H
+#define MOCK_ATTRIBS_H
+
+#define __ISR(vector, ipl)
+
+#define _CORE_TIMER_VECTOR 0
+#define _INPUT_CAPTURE_1_VECTOR 5
+#define _UART_2_VECTOR 37
+
+#endif
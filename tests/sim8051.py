@@ -0,0 +1,835 @@
+"""A small 8051 assembler and instruction-set simulator for testing the N76E003
+assembly programs on the host.
+
+The assembler takes the a51 dialect the lab programs are written in: ORG, EQU, DSEG,
+BSEG, CSEG, DS, DB, DBIT, $include and bit names like P1.3.  The LCD and math32
+libraries are not in this tree, so their macro lines (Set_Cursor(1, 1), Load_y(100),
+...) are skipped, and a call to any routine that is not defined goes to a stub that
+just returns.  Asm.stubs lists them.
+
+Cycle counts are standard 8051 machine cycles (12 clocks each): 1 or 2 per instruction,
+4 for MUL and DIV.  The N76E003 core needs fewer clocks per instruction, so use the
+counts to compare code paths, not as exact times on the chip.
+"""
+import os
+import re
+
+SFRS = {
+    'p0': 0x80, 'sp': 0x81, 'dpl': 0x82, 'dph': 0x83, 'pcon': 0x87, 'tcon': 0x88,
+    'tmod': 0x89, 'tl0': 0x8a, 'tl1': 0x8b, 'th0': 0x8c, 'th1': 0x8d, 'ckcon': 0x8e,
+    'p1': 0x90, 'sfrs': 0x91, 'scon': 0x98, 'sbuf': 0x99, 'eie': 0x9b, 'ie': 0xa8,
+    'p3m1': 0xac, 'p3m2': 0xad, 'p3': 0xb0, 'p0m1': 0xb1, 'p0m2': 0xb2, 'p1m1': 0xb3,
+    'p1m2': 0xb4, 'ip': 0xb8, 'adcrl': 0xc2, 'adcrh': 0xc3, 't3con': 0xc4,
+    'piocon1': 0xc6, 'ta': 0xc7, 't2con': 0xc8, 't2mod': 0xc9, 'rcmp2l': 0xca,
+    'rcmp2h': 0xcb, 'tl2': 0xcc, 'th2': 0xcd, 'psw': 0xd0, 'pwmph': 0xd1,
+    'pwm2h': 0xd4, 'pwmcon0': 0xd8, 'pwmpl': 0xd9, 'pwm2l': 0xdc, 'pwmcon1': 0xdf,
+    'acc': 0xe0, 'adccon1': 0xe1, 'adccon0': 0xe8, 'b': 0xf0, 'aindids': 0xf6,
+}
+SFRS.update({'ar%d' % n: n for n in range(8)}) # Bank 0 registers as direct addresses
+
+BITS = {
+    'it0': 0x88, 'ie0': 0x89, 'it1': 0x8a, 'ie1': 0x8b, 'tr0': 0x8c, 'tf0': 0x8d,
+    'tr1': 0x8e, 'tf1': 0x8f, 'ri': 0x98, 'ti': 0x99, 'ex0': 0xa8, 'et0': 0xa9,
+    'ex1': 0xaa, 'et1': 0xab, 'es': 0xac, 'ea': 0xaf, 'pt0': 0xb9, 'pt1': 0xbb,
+    'ps': 0xbc, 'tr2': 0xca, 'tf2': 0xcf, 'adcs': 0xee, 'adcf': 0xef, 'ov': 0xd2,
+    'rs0': 0xd3, 'rs1': 0xd4, 'cy': 0xd7,
+}
+
+ACC, B, PSW, SP, DPL, DPH = 0xe0, 0xf0, 0xd0, 0x81, 0x82, 0x83
+STUB_BASE = 0xf000 # Stubs for the routines that are not in the tree
+RETURN = 0xfffe # Return address of Sim.call(): the run stops when it gets there
+IDLE = 0xfff0 # 'sjmp $' for Sim.wait()
+
+
+class AsmError(Exception):
+    pass
+
+
+def _split_operands(s):
+    """Splits at the commas that are not in quotes or parentheses."""
+    out, cur, depth, quote = [], '', 0, None
+    for ch in s:
+        if quote:
+            cur += ch
+            if ch == quote and not cur.endswith('\\' + quote):
+                quote = None
+        elif ch in '\'"':
+            quote = ch
+            cur += ch
+        elif ch == '(':
+            depth += 1
+            cur += ch
+        elif ch == ')':
+            depth -= 1
+            cur += ch
+        elif ch == ',' and depth == 0:
+            out.append(cur.strip())
+            cur = ''
+        else:
+            cur += ch
+    if cur.strip():
+        out.append(cur.strip())
+    return out
+
+
+def _strip_comment(line):
+    quote = None
+    for i, ch in enumerate(line):
+        if quote:
+            if ch == quote:
+                quote = None
+        elif ch in '\'"':
+            quote = ch
+        elif ch == ';':
+            return line[:i]
+    return line
+
+
+_TOKEN = re.compile(r"""\s*(?:
+    (?P<hex>0[xX][0-9a-fA-F]+) |
+    (?P<bin>0[bB][01]+\b) |
+    (?P<hexh>[0-9][0-9a-fA-F]*[hH]\b) |
+    (?P<dec>[0-9]+) |
+    (?P<char>'(?:\\.|[^'])') |
+    (?P<bit>[A-Za-z_]\w*\.[0-7]\b) |
+    (?P<name>[A-Za-z_]\w*) |
+    (?P<here>\$) |
+    (?P<op><<|>>|[-+*/()&|~^%]))""", re.X)
+
+_ESCAPES = {'n': 10, 'r': 13, 't': 9, '0': 0, '\\': 92, "'": 39, '"': 34}
+
+
+def _char_value(s):
+    if s.startswith('\\'):
+        return _ESCAPES[s[1]]
+    return ord(s)
+
+
+class Asm:
+    """Assembles a source file.  code is the 64K code memory and symbols maps the
+    lower case names to their values.  defines gives symbols values that win over the
+    EQUs in the source, to try a program with other settings."""
+
+    def __init__(self, path, defines=None):
+        self.path = path
+        self.symbols = dict(SFRS)
+        self.symbols.update(BITS)
+        self.predefined = {k.lower(): v for k, v in (defines or {}).items()}
+        self.stubs = {}
+        self.skipped_macros = set()
+        self.lines = []
+        self._read(path)
+        self._assemble()
+
+    # Source
+
+    def _read(self, path):
+        with open(path) as f:
+            for number, line in enumerate(f, 1):
+                m = re.match(r'\s*\$include\s*\(\s*([^)]+?)\s*\)', line, re.I)
+                if m:
+                    inc = os.path.join(os.path.dirname(path), m.group(1))
+                    if os.path.exists(inc): # LCD_4bit.inc and math32.inc are not in the tree
+                        self._read(inc)
+                    continue
+                if line.lstrip().startswith('$'):
+                    continue
+                self.lines.append((path, number, _strip_comment(line).rstrip()))
+
+    # Expressions
+
+    def value(self, expr, final=True):
+        py = []
+        pos = 0
+        expr = expr.strip()
+        while pos < len(expr):
+            m = _TOKEN.match(expr, pos)
+            if not m or m.end() == pos:
+                raise AsmError('bad expression: %s' % expr)
+            pos = m.end()
+            kind, text = m.lastgroup, m.group(m.lastgroup)
+            if kind == 'hex':
+                py.append(str(int(text, 16)))
+            elif kind == 'bin':
+                py.append(str(int(text[2:], 2)))
+            elif kind == 'hexh':
+                py.append(str(int(text[:-1], 16)))
+            elif kind == 'dec':
+                py.append(text)
+            elif kind == 'char':
+                py.append(str(_char_value(text[1:-1])))
+            elif kind == 'bit':
+                byte, n = text.lower().split('.')
+                addr = self._symbol(byte, final)
+                py.append(str((addr if addr >= 0x80 else (addr - 0x20)*8) + int(n)))
+            elif kind == 'name':
+                name = text.lower()
+                if name in ('low', 'high'):
+                    py.append('_' + name)
+                else:
+                    py.append(str(self._symbol(name, final)))
+            elif kind == 'here':
+                py.append(str(self.pc))
+            else:
+                py.append('//' if text == '/' else text)
+        return eval(' '.join(py), {'_low': lambda v: v & 0xff, '_high': lambda v: (v >> 8) & 0xff})
+
+    def _symbol(self, name, final):
+        if name in self.symbols:
+            return self.symbols[name]
+        if name in self.predefined:
+            return self.predefined[name]
+        if not final:
+            return 0
+        # A routine from a library that is not in the tree: a stub that returns
+        if name not in self.stubs:
+            addr = STUB_BASE + len(self.stubs)
+            self.stubs[name] = addr
+            self.code[addr] = 0x22 # ret
+        return self.stubs[name]
+
+    # Two passes
+
+    def _assemble(self):
+        self.code = bytearray(0x10000)
+        self.lines_at = {} # Code address to source line, for error messages
+        for final in (False, True):
+            self.final = final
+            self.pc = 0
+            self.data_pc = 0x30
+            self.bit_pc = 0
+            self.segment = 'code'
+            for path, number, line in self.lines:
+                try:
+                    if self._line(line) == 'end':
+                        break
+                except AsmError as e:
+                    raise AsmError('%s:%d: %s' % (os.path.basename(path), number, e))
+                except (SyntaxError, NameError, KeyError, ZeroDivisionError) as e:
+                    raise AsmError('%s:%d: %s (%s)' % (os.path.basename(path), number, line.strip(), e))
+
+    def _define(self, name, value):
+        name = name.lower()
+        value = self.predefined.get(name, value)
+        if not self.final and name in self.symbols and name not in SFRS and name not in BITS \
+                and self.symbols[name] != value:
+            raise AsmError('%s defined twice' % name)
+        self.symbols[name] = value
+
+    def _line(self, line):
+        m = re.match(r'\s*([A-Za-z_]\w*)\s+(equ|set)\s+(.+)$', line, re.I)
+        if m:
+            self._define(m.group(1), self.value(m.group(3), self.final))
+            return
+        m = re.match(r'\s*([A-Za-z_]\w*)\s*:(.*)$', line)
+        if m:
+            # Instructions always go to the code segment, even after a DSEG or BSEG
+            word = m.group(2).strip().split(None, 1)[0].lower() if m.group(2).strip() else ''
+            if word == 'dbit':
+                here = self.bit_pc
+            elif word in ('ds', 'db') and self.segment == 'data':
+                here = self.data_pc
+            else:
+                here = self.pc
+            self._define(m.group(1), here)
+            line = m.group(2)
+        parts = line.strip().split(None, 1)
+        if not parts:
+            return
+        word = parts[0].lower()
+        rest = parts[1] if len(parts) > 1 else ''
+        if word == 'end':
+            return 'end'
+        if word in ('dseg', 'bseg', 'cseg'):
+            self.segment = {'dseg': 'data', 'bseg': 'bit', 'cseg': 'code'}[word]
+            m = re.match(r'at\s+(.+)', rest, re.I)
+            if m:
+                v = self.value(m.group(1))
+                if word == 'dseg':
+                    self.data_pc = v
+                elif word == 'bseg':
+                    self.bit_pc = v
+                else:
+                    self.pc = v
+            return
+        if word == 'org':
+            self.pc = self.value(rest)
+            self.segment = 'code'
+            return
+        if word == 'ds':
+            n = self.value(rest)
+            if self.segment == 'data':
+                self.data_pc += n
+            else:
+                self.pc += n
+            return
+        if word == 'dbit':
+            self.bit_pc += self.value(rest)
+            return
+        if word in ('db', 'dw'):
+            data = self._data(word, rest)
+            if self.segment == 'data':
+                self.data_pc += len(data)
+            else:
+                self._emit(data)
+            return
+        if re.match(r'[A-Za-z_]\w*\s*\(', line.strip()) and word.split('(')[0] not in _MNEMONICS:
+            self.skipped_macros.add(line.strip().split('(')[0].strip().lower())
+            return
+        if word not in _MNEMONICS:
+            raise AsmError('unknown instruction: %s' % line.strip())
+        self._emit(self._encode(word, _split_operands(rest)))
+
+    def _data(self, word, rest):
+        out = []
+        for item in _split_operands(rest):
+            if word == 'db' and len(item) >= 2 and item[0] in '\'"' and item[-1] == item[0]:
+                s = item[1:-1]
+                i = 0
+                while i < len(s):
+                    if s[i] == '\\' and i + 1 < len(s):
+                        out.append(_ESCAPES[s[i + 1]])
+                        i += 2
+                    else:
+                        out.append(ord(s[i]))
+                        i += 1
+            else:
+                v = self.value(item, self.final)
+                out += [v & 0xff] if word == 'db' else [(v >> 8) & 0xff, v & 0xff]
+        return out
+
+    def _emit(self, data):
+        if self.final:
+            for i, byte in enumerate(data):
+                self.code[self.pc + i] = byte & 0xff
+        self.pc += len(data)
+
+    # Instructions
+
+    def _kind(self, op):
+        o = op.lower().replace(' ', '')
+        if o in ('a', 'c', 'ab', 'dptr', '@a+dptr', '@a+pc', '@dptr'):
+            return o, None
+        if o in ('@r0', '@r1'):
+            return '@ri', int(o[2])
+        if re.fullmatch(r'r[0-7]', o):
+            return 'rn', int(o[1])
+        if o.startswith('#'):
+            return 'imm', op.strip()[1:]
+        if o.startswith('/'):
+            return 'nbit', op.strip()[1:]
+        return 'dir', op.strip()
+
+    def _encode(self, mn, ops):
+        final = self.final
+        kinds = [self._kind(o) for o in ops]
+        k = tuple(x[0] for x in kinds)
+        v = [x[1] for x in kinds]
+        val = lambda e: self.value(e, final) if isinstance(e, str) else e
+
+        def rel(e, size):
+            if not final:
+                return 0
+            off = val(e) - (self.pc + size)
+            if not -128 <= off <= 127:
+                raise AsmError('relative jump out of range')
+            return off & 0xff
+
+        def b8(e):
+            return val(e) & 0xff
+
+        alu = {'add': 0x20, 'addc': 0x30, 'subb': 0x90, 'orl': 0x40, 'anl': 0x50, 'xrl': 0x60}
+        if mn == 'nop': return [0x00]
+        if mn == 'ret': return [0x22]
+        if mn == 'reti': return [0x32]
+        if mn == 'ljmp': return [0x02, val(v[0]) >> 8, b8(v[0])]
+        if mn == 'lcall': return [0x12, val(v[0]) >> 8, b8(v[0])]
+        if mn in ('ajmp', 'acall'):
+            a = val(v[0]) if final else 0
+            return [((a >> 3) & 0xe0) | (0x01 if mn == 'ajmp' else 0x11), a & 0xff]
+        if mn == 'sjmp': return [0x80, rel(v[0], 2)]
+        if mn == 'jmp':
+            if k == ('@a+dptr',): return [0x73]
+            return [0x02, val(v[0]) >> 8, b8(v[0])]
+        if mn == 'call': return [0x12, val(v[0]) >> 8, b8(v[0])]
+        if mn in ('jc', 'jnc', 'jz', 'jnz'):
+            return [{'jc': 0x40, 'jnc': 0x50, 'jz': 0x60, 'jnz': 0x70}[mn], rel(v[0], 2)]
+        if mn in ('jb', 'jnb', 'jbc'):
+            return [{'jb': 0x20, 'jnb': 0x30, 'jbc': 0x10}[mn], b8(v[0]), rel(v[1], 3)]
+        if mn == 'djnz':
+            if k[0] == 'rn': return [0xd8 + v[0], rel(v[1], 2)]
+            return [0xd5, b8(v[0]), rel(v[1], 3)]
+        if mn == 'cjne':
+            if k[:2] == ('a', 'imm'): return [0xb4, b8(v[1]), rel(v[2], 3)]
+            if k[:2] == ('a', 'dir'): return [0xb5, b8(v[1]), rel(v[2], 3)]
+            if k[0] == '@ri': return [0xb6 + v[0], b8(v[1]), rel(v[2], 3)]
+            if k[0] == 'rn': return [0xb8 + v[0], b8(v[1]), rel(v[2], 3)]
+        if mn in ('inc', 'dec'):
+            base = 0x00 if mn == 'inc' else 0x10
+            if k == ('a',): return [base + 0x04]
+            if k == ('dptr',) and mn == 'inc': return [0xa3]
+            if k == ('@ri',): return [base + 0x06 + v[0]]
+            if k == ('rn',): return [base + 0x08 + v[0]]
+            if k == ('dir',): return [base + 0x05, b8(v[0])]
+        if mn in alu:
+            base = alu[mn]
+            if k == ('c', 'dir') and mn in ('orl', 'anl'): return [{'orl': 0x72, 'anl': 0x82}[mn], b8(v[1])]
+            if k == ('c', 'nbit') and mn in ('orl', 'anl'): return [{'orl': 0xa0, 'anl': 0xb0}[mn], b8(v[1])]
+            if k == ('dir', 'a') and mn in ('orl', 'anl', 'xrl'): return [base + 0x02, b8(v[0])]
+            if k == ('dir', 'imm') and mn in ('orl', 'anl', 'xrl'): return [base + 0x03, b8(v[0]), b8(v[1])]
+            if k == ('a', 'imm'): return [base + 0x04, b8(v[1])]
+            if k == ('a', 'dir'): return [base + 0x05, b8(v[1])]
+            if k == ('a', '@ri'): return [base + 0x06 + v[1]]
+            if k == ('a', 'rn'): return [base + 0x08 + v[1]]
+        if mn == 'mov':
+            if k == ('a', 'imm'): return [0x74, b8(v[1])]
+            if k == ('dir', 'imm'): return [0x75, b8(v[0]), b8(v[1])]
+            if k == ('@ri', 'imm'): return [0x76 + v[0], b8(v[1])]
+            if k == ('rn', 'imm'): return [0x78 + v[0], b8(v[1])]
+            if k == ('dir', 'dir'): return [0x85, b8(v[1]), b8(v[0])]
+            if k == ('dir', '@ri'): return [0x86 + v[1], b8(v[0])]
+            if k == ('dir', 'rn'): return [0x88 + v[1], b8(v[0])]
+            if k == ('dptr', 'imm'): return [0x90, val(v[1]) >> 8 & 0xff, b8(v[1])]
+            if k == ('dir', 'c'): return [0x92, b8(v[0])]
+            if k == ('c', 'dir'): return [0xa2, b8(v[1])]
+            if k == ('@ri', 'dir'): return [0xa6 + v[0], b8(v[1])]
+            if k == ('rn', 'dir'): return [0xa8 + v[0], b8(v[1])]
+            if k == ('a', 'dir'): return [0xe5, b8(v[1])]
+            if k == ('a', '@ri'): return [0xe6 + v[1]]
+            if k == ('a', 'rn'): return [0xe8 + v[1]]
+            if k == ('dir', 'a'): return [0xf5, b8(v[0])]
+            if k == ('@ri', 'a'): return [0xf6 + v[0]]
+            if k == ('rn', 'a'): return [0xf8 + v[0]]
+        if mn == 'movc':
+            if k == ('a', '@a+dptr'): return [0x93]
+            if k == ('a', '@a+pc'): return [0x83]
+        if mn == 'movx':
+            if k == ('a', '@dptr'): return [0xe0]
+            if k == ('a', '@ri'): return [0xe2 + v[1]]
+            if k == ('@dptr', 'a'): return [0xf0]
+            if k == ('@ri', 'a'): return [0xf2 + v[0]]
+        if mn == 'push': return [0xc0, b8(v[0])]
+        if mn == 'pop': return [0xd0, b8(v[0])]
+        if mn == 'xch':
+            if k == ('a', 'dir'): return [0xc5, b8(v[1])]
+            if k == ('a', '@ri'): return [0xc6 + v[1]]
+            if k == ('a', 'rn'): return [0xc8 + v[1]]
+        if mn == 'xchd' and k == ('a', '@ri'): return [0xd6 + v[1]]
+        if mn in ('clr', 'setb', 'cpl'):
+            if k == ('a',) and mn != 'setb': return [{'clr': 0xe4, 'cpl': 0xf4}[mn]]
+            if k == ('c',): return [{'clr': 0xc3, 'setb': 0xd3, 'cpl': 0xb3}[mn]]
+            if k == ('dir',): return [{'clr': 0xc2, 'setb': 0xd2, 'cpl': 0xb2}[mn], b8(v[0])]
+        single = {'rl': 0x23, 'rlc': 0x33, 'rr': 0x03, 'rrc': 0x13, 'swap': 0xc4, 'da': 0xd4,
+                  'mul': 0xa4, 'div': 0x84}
+        if mn in single:
+            return [single[mn]]
+        raise AsmError('bad operands: %s %s' % (mn, ', '.join(ops)))
+
+    def __getitem__(self, name):
+        return self.symbols[name.lower()]
+
+
+_MNEMONICS = {
+    'nop', 'ret', 'reti', 'ljmp', 'lcall', 'ajmp', 'acall', 'sjmp', 'jmp', 'call', 'jc', 'jnc',
+    'jz', 'jnz', 'jb', 'jnb', 'jbc', 'djnz', 'cjne', 'inc', 'dec', 'add', 'addc', 'subb', 'orl',
+    'anl', 'xrl', 'mov', 'movc', 'movx', 'push', 'pop', 'xch', 'xchd', 'clr', 'setb', 'cpl',
+    'rl', 'rlc', 'rr', 'rrc', 'swap', 'da', 'mul', 'div',
+}
+
+# Machine cycles of each opcode: 1 unless listed
+_CYCLES = [1]*256
+for _op in [0x02, 0x12, 0x22, 0x32, 0x80, 0x73, 0x40, 0x50, 0x60, 0x70, 0x10, 0x20, 0x30,
+            0xd5, 0xa3, 0x90, 0x83, 0x93, 0xe0, 0xe2, 0xe3, 0xf0, 0xf2, 0xf3, 0xc0, 0xd0,
+            0x85, 0x75, 0x86, 0x87, 0xa6, 0xa7, 0x43, 0x53, 0x63, 0x72, 0x82, 0xa0, 0xb0, 0x92]:
+    _CYCLES[_op] = 2
+for _op in list(range(0xb4, 0xc0)) + list(range(0xd8, 0xe0)) + list(range(0x88, 0x90)) + \
+        list(range(0xa8, 0xb0)) + [n*0x20 + 0x01 for n in range(8)] + [n*0x20 + 0x11 for n in range(8)]:
+    _CYCLES[_op] = 2
+_CYCLES[0xa4] = _CYCLES[0x84] = 4
+
+
+class Sim:
+    """Runs a program from Asm.  Registers and RAM are plain byte arrays.  A test models
+    the peripherals it needs with:
+      sfr_write, sfr_read  callbacks for the registers, by address
+      hooks                functions called before every instruction
+      interrupts           (vector, pending) pairs: pending(sim) says if it wants to run
+    isr_log gets the cycles of every interrupt that runs, from the vector to RETI."""
+
+    def __init__(self, asm):
+        self.asm = asm
+        self.code = bytearray(asm.code)
+        self.code[IDLE:IDLE + 2] = bytes([0x80, 0xfe])
+        self.iram = bytearray(256)
+        self.sfr = bytearray(256) # Only 0x80 to 0xFF are used
+        self.sfr[SP] = 0x07
+        self.pc = 0
+        self.cycles = 0
+        self.sfr_write = {}
+        self.sfr_read = {}
+        self.interrupts = []
+        self.in_isr = False
+        self.isr_cycles = 0 # Spent in interrupts, which call() leaves out
+        self.isr_log = []
+        self.hooks = []
+
+    def __getitem__(self, name):
+        return self.asm[name]
+
+    # Memory
+
+    def read(self, addr):
+        if addr < 0x80:
+            return self.iram[addr]
+        if addr in self.sfr_read:
+            return self.sfr_read[addr](self) & 0xff
+        if addr == PSW:
+            return (self.sfr[PSW] & 0xfe) | (bin(self.sfr[ACC]).count('1') & 1)
+        return self.sfr[addr]
+
+    def write(self, addr, value):
+        value &= 0xff
+        if addr < 0x80:
+            self.iram[addr] = value
+        else:
+            self.sfr[addr] = value
+            if addr in self.sfr_write:
+                self.sfr_write[addr](self, value)
+
+    def bit(self, addr):
+        if addr < 0x80:
+            return (self.iram[0x20 + (addr >> 3)] >> (addr & 7)) & 1
+        return (self.read(addr & 0xf8) >> (addr & 7)) & 1
+
+    def set_bit(self, addr, value):
+        byte = 0x20 + (addr >> 3) if addr < 0x80 else addr & 0xf8
+        old = self.iram[byte] if addr < 0x80 else self.sfr[byte]
+        new = (old | (1 << (addr & 7))) if value else (old & ~(1 << (addr & 7)))
+        self.write(byte, new)
+
+    def var(self, name, size=1):
+        """Little endian value of a data variable"""
+        addr = self.asm[name]
+        return sum(self.iram[addr + i] << (8*i) for i in range(size))
+
+    def set_var(self, name, value, size=1):
+        addr = self.asm[name]
+        for i in range(size):
+            self.iram[addr + i] = (value >> (8*i)) & 0xff
+
+    def flag(self, name):
+        return self.bit(self.asm[name])
+
+    def set_flag(self, name, value):
+        self.set_bit(self.asm[name], value)
+
+    @property
+    def a(self):
+        return self.sfr[ACC]
+
+    @a.setter
+    def a(self, v):
+        self.sfr[ACC] = v & 0xff
+
+    def _reg_addr(self, n):
+        return (self.sfr[PSW] & 0x18) + n
+
+    def reg(self, n):
+        return self.iram[self._reg_addr(n)]
+
+    def set_reg(self, n, v):
+        self.iram[self._reg_addr(n)] = v & 0xff
+
+    @property
+    def cy(self):
+        return self.sfr[PSW] >> 7
+
+    @cy.setter
+    def cy(self, v):
+        self.sfr[PSW] = (self.sfr[PSW] & 0x7f) | (0x80 if v else 0)
+
+    def push(self, v):
+        self.sfr[SP] = (self.sfr[SP] + 1) & 0xff
+        self.iram[self.sfr[SP]] = v & 0xff
+
+    def pop(self):
+        v = self.iram[self.sfr[SP]]
+        self.sfr[SP] = (self.sfr[SP] - 1) & 0xff
+        return v
+
+    @property
+    def dptr(self):
+        return (self.sfr[DPH] << 8) | self.sfr[DPL]
+
+    @dptr.setter
+    def dptr(self, v):
+        self.sfr[DPH] = (v >> 8) & 0xff
+        self.sfr[DPL] = v & 0xff
+
+    # Running
+
+    def call(self, name, max_cycles=1000000, isr=False):
+        """Runs the routine until it returns, with interrupts.  Returns its machine cycles,
+        not counting any interrupt that ran in between."""
+        self.pc = self.asm[name] if isinstance(name, str) else name
+        self.push(RETURN & 0xff)
+        self.push(RETURN >> 8)
+        if isr:
+            self.in_isr = True
+        start, isr_cycles = self.cycles, self.isr_cycles
+        while self.pc != RETURN:
+            if self.cycles - start > max_cycles:
+                raise RuntimeError('%s did not return in %d cycles' % (name, max_cycles))
+            self.step()
+        return self.cycles - start - (self.isr_cycles - isr_cycles)
+
+    def wait(self, done, max_cycles=1000000):
+        """Lets the interrupts run, as if the main program was in a 'sjmp $' loop, until
+        done(sim) is true."""
+        pc, start = self.pc, self.cycles
+        self.pc = IDLE
+        while not done(self):
+            if self.cycles - start > max_cycles:
+                raise RuntimeError('still waiting after %d cycles' % max_cycles)
+            self.step()
+        self.pc = pc
+
+    def _interrupt(self):
+        if self.in_isr or not self.bit(BITS['ea']):
+            return False
+        for vector, pending in self.interrupts:
+            if pending(self):
+                self.push(self.pc & 0xff)
+                self.push(self.pc >> 8)
+                self.pc = vector
+                self.in_isr = True
+                self.isr_start = self.cycles
+                self.cycles += 2 # The LCALL the hardware makes
+                return True
+        return False
+
+    def step(self):
+        for hook in self.hooks:
+            hook(self)
+        if not self.in_isr and self.interrupts:
+            self._interrupt()
+        code, pc = self.code, self.pc
+        op = code[pc]
+        b1 = code[(pc + 1) & 0xffff]
+        b2 = code[(pc + 2) & 0xffff]
+        self.cycles += _CYCLES[op]
+        rel = lambda x: x - 256 if x > 127 else x
+        lo = op & 0x0f
+
+        # The arithmetic and logic rows share the same low nibble layout
+        if lo >= 0x04 and op >> 4 in (0x2, 0x3, 0x4, 0x5, 0x6, 0x9):
+            if lo == 0x04:
+                src, size = b1, 2
+            elif lo == 0x05:
+                src, size = self.read(b1), 2
+            elif lo in (0x06, 0x07):
+                src, size = self.iram[self.reg(lo - 6)], 1
+            else:
+                src, size = self.reg(lo - 8), 1
+            self.pc = pc + size
+            self._alu(op >> 4, src)
+            return
+        if op >> 4 in (0x4, 0x5, 0x6) and lo in (0x02, 0x03):
+            f = {0x4: lambda x, y: x | y, 0x5: lambda x, y: x & y, 0x6: lambda x, y: x ^ y}[op >> 4]
+            if lo == 0x02:
+                self.write(b1, f(self.read(b1), self.a))
+                self.pc = pc + 2
+            else:
+                self.write(b1, f(self.read(b1), b2))
+                self.pc = pc + 3
+            return
+        if op & 0x1f == 0x01: # ajmp
+            self.pc = ((pc + 2) & 0xf800) | ((op & 0xe0) << 3) | b1
+            return
+        if op & 0x1f == 0x11: # acall
+            ret = pc + 2
+            self.push(ret & 0xff)
+            self.push(ret >> 8)
+            self.pc = (ret & 0xf800) | ((op & 0xe0) << 3) | b1
+            return
+        if op >= 0x08 and lo >= 0x08 and op >> 4 in (0x0, 0x1, 0xd, 0xe, 0xf, 0x7, 0xa, 0x8, 0xb, 0xc):
+            n = lo - 8
+            hi = op >> 4
+            if hi == 0x0: self.set_reg(n, self.reg(n) + 1); self.pc = pc + 1
+            elif hi == 0x1: self.set_reg(n, self.reg(n) - 1); self.pc = pc + 1
+            elif hi == 0x7: self.set_reg(n, b1); self.pc = pc + 2
+            elif hi == 0x8: self.write(b1, self.reg(n)); self.pc = pc + 2
+            elif hi == 0xa: self.set_reg(n, self.read(b1)); self.pc = pc + 2
+            elif hi == 0xb:
+                x = self.reg(n)
+                self.cy = x < b1
+                self.pc = pc + 3 + (rel(b2) if x != b1 else 0)
+            elif hi == 0xc: x = self.reg(n); self.set_reg(n, self.a); self.a = x; self.pc = pc + 1
+            elif hi == 0xd:
+                self.set_reg(n, self.reg(n) - 1)
+                self.pc = pc + 2 + (rel(b1) if self.reg(n) else 0)
+            elif hi == 0xe: self.a = self.reg(n); self.pc = pc + 1
+            elif hi == 0xf: self.set_reg(n, self.a); self.pc = pc + 1
+            return
+        if lo in (0x06, 0x07) and op >> 4 in (0x0, 0x1, 0x7, 0x8, 0xa, 0xb, 0xc, 0xd, 0xe, 0xf):
+            r = self.reg(lo - 6)
+            hi = op >> 4
+            if hi == 0x0: self.iram[r] = (self.iram[r] + 1) & 0xff; self.pc = pc + 1
+            elif hi == 0x1: self.iram[r] = (self.iram[r] - 1) & 0xff; self.pc = pc + 1
+            elif hi == 0x7: self.iram[r] = b1; self.pc = pc + 2
+            elif hi == 0x8: self.write(b1, self.iram[r]); self.pc = pc + 2
+            elif hi == 0xa: self.iram[r] = self.read(b1); self.pc = pc + 2
+            elif hi == 0xb:
+                x = self.iram[r]
+                self.cy = x < b1
+                self.pc = pc + 3 + (rel(b2) if x != b1 else 0)
+            elif hi == 0xc: x = self.iram[r]; self.iram[r] = self.a; self.a = x; self.pc = pc + 1
+            elif hi == 0xd:
+                x = self.iram[r]
+                self.iram[r] = (x & 0xf0) | (self.a & 0x0f)
+                self.a = (self.a & 0xf0) | (x & 0x0f)
+                self.pc = pc + 1
+            elif hi == 0xe: self.a = self.iram[r]; self.pc = pc + 1
+            elif hi == 0xf: self.iram[r] = self.a; self.pc = pc + 1
+            return
+        if op in (0xe2, 0xe3, 0xf2, 0xf3, 0xe0, 0xf0):
+            raise RuntimeError('MOVX at %04x: no external RAM in this simulator' % pc)
+
+        if op == 0x00: self.pc = pc + 1
+        elif op == 0x02: self.pc = (b1 << 8) | b2
+        elif op == 0x12:
+            ret = pc + 3
+            self.push(ret & 0xff)
+            self.push(ret >> 8)
+            self.pc = (b1 << 8) | b2
+        elif op in (0x22, 0x32):
+            hi = self.pop()
+            self.pc = (hi << 8) | self.pop()
+            if op == 0x32:
+                self.in_isr = False
+                if hasattr(self, 'isr_start'):
+                    self.isr_cycles += self.cycles - self.isr_start
+                    self.isr_log.append(self.cycles - self.isr_start)
+                    del self.isr_start
+        elif op == 0x80: self.pc = pc + 2 + rel(b1)
+        elif op == 0x73: self.pc = (self.a + self.dptr) & 0xffff
+        elif op in (0x40, 0x50, 0x60, 0x70):
+            take = {0x40: self.cy, 0x50: not self.cy, 0x60: self.a == 0, 0x70: self.a != 0}[op]
+            self.pc = pc + 2 + (rel(b1) if take else 0)
+        elif op in (0x10, 0x20, 0x30):
+            x = self.bit(b1)
+            take = x if op != 0x30 else not x
+            if op == 0x10 and x:
+                self.set_bit(b1, 0)
+            self.pc = pc + 3 + (rel(b2) if take else 0)
+        elif op == 0xd5:
+            x = (self.read(b1) - 1) & 0xff
+            self.write(b1, x)
+            self.pc = pc + 3 + (rel(b2) if x else 0)
+        elif op in (0xb4, 0xb5):
+            y = b1 if op == 0xb4 else self.read(b1)
+            self.cy = self.a < y
+            self.pc = pc + 3 + (rel(b2) if self.a != y else 0)
+        elif op == 0x04: self.a = self.a + 1; self.pc = pc + 1
+        elif op == 0x14: self.a = self.a - 1; self.pc = pc + 1
+        elif op == 0x05: self.write(b1, self.read(b1) + 1); self.pc = pc + 2
+        elif op == 0x15: self.write(b1, self.read(b1) - 1); self.pc = pc + 2
+        elif op == 0xa3: self.dptr = (self.dptr + 1) & 0xffff; self.pc = pc + 1
+        elif op == 0x72: self.cy = self.cy | self.bit(b1); self.pc = pc + 2
+        elif op == 0xa0: self.cy = self.cy | (not self.bit(b1)); self.pc = pc + 2
+        elif op == 0x82: self.cy = self.cy & self.bit(b1); self.pc = pc + 2
+        elif op == 0xb0: self.cy = self.cy & (not self.bit(b1)); self.pc = pc + 2
+        elif op == 0x74: self.a = b1; self.pc = pc + 2
+        elif op == 0x75: self.write(b1, b2); self.pc = pc + 3
+        elif op == 0x85: self.write(b2, self.read(b1)); self.pc = pc + 3
+        elif op == 0x90: self.dptr = (b1 << 8) | b2; self.pc = pc + 3
+        elif op == 0x92: self.set_bit(b1, self.cy); self.pc = pc + 2
+        elif op == 0xa2: self.cy = self.bit(b1); self.pc = pc + 2
+        elif op == 0xe5: self.a = self.read(b1); self.pc = pc + 2
+        elif op == 0xf5: self.write(b1, self.a); self.pc = pc + 2
+        elif op == 0x93: self.a = self.code[(self.a + self.dptr) & 0xffff]; self.pc = pc + 1
+        elif op == 0x83: self.a = self.code[(self.a + pc + 1) & 0xffff]; self.pc = pc + 1
+        elif op == 0xc0: self.push(self.read(b1)); self.pc = pc + 2
+        elif op == 0xd0:
+            self.write(b1, self.pop())
+            self.pc = pc + 2
+        elif op == 0xc5:
+            x = self.read(b1)
+            self.write(b1, self.a)
+            self.a = x
+            self.pc = pc + 2
+        elif op == 0xe4: self.a = 0; self.pc = pc + 1
+        elif op == 0xf4: self.a = ~self.a; self.pc = pc + 1
+        elif op == 0xc3: self.cy = 0; self.pc = pc + 1
+        elif op == 0xd3: self.cy = 1; self.pc = pc + 1
+        elif op == 0xb3: self.cy = not self.cy; self.pc = pc + 1
+        elif op == 0xc2: self.set_bit(b1, 0); self.pc = pc + 2
+        elif op == 0xd2: self.set_bit(b1, 1); self.pc = pc + 2
+        elif op == 0xb2: self.set_bit(b1, not self.bit(b1)); self.pc = pc + 2
+        elif op == 0x23: self.a = (self.a << 1) | (self.a >> 7); self.pc = pc + 1
+        elif op == 0x03: self.a = (self.a >> 1) | ((self.a & 1) << 7); self.pc = pc + 1
+        elif op == 0x33:
+            c = self.a >> 7
+            self.a = (self.a << 1) | self.cy
+            self.cy = c
+            self.pc = pc + 1
+        elif op == 0x13:
+            c = self.a & 1
+            self.a = (self.a >> 1) | (self.cy << 7)
+            self.cy = c
+            self.pc = pc + 1
+        elif op == 0xc4: self.a = ((self.a << 4) | (self.a >> 4)); self.pc = pc + 1
+        elif op == 0xd4:
+            a = self.a
+            if (a & 0x0f) > 9 or self.sfr[PSW] & 0x40:
+                a += 6
+            if (a >> 4) > 9 or self.cy or a > 0xff:
+                a += 0x60
+            if a > 0xff:
+                self.cy = 1
+            self.a = a
+            self.pc = pc + 1
+        elif op == 0xa4:
+            p = self.a*self.sfr[B]
+            self.a = p
+            self.sfr[B] = p >> 8
+            self.cy = 0
+            self._ov(p > 0xff)
+            self.pc = pc + 1
+        elif op == 0x84:
+            self.cy = 0
+            if self.sfr[B] == 0:
+                self._ov(1)
+            else:
+                q, r = divmod(self.a, self.sfr[B])
+                self.a = q
+                self.sfr[B] = r
+                self._ov(0)
+            self.pc = pc + 1
+        else:
+            raise RuntimeError('opcode %02x at %04x not simulated' % (op, pc))
+
+    def _ov(self, v):
+        self.sfr[PSW] = (self.sfr[PSW] & ~0x04) | (0x04 if v else 0)
+
+    def _alu(self, row, src):
+        a = self.a
+        if row in (0x2, 0x3):
+            c = self.cy if row == 0x3 else 0
+            r = a + src + c
+            ac = ((a & 0x0f) + (src & 0x0f) + c) > 0x0f
+            ov = ((a ^ r) & (src ^ r) & 0x80) != 0
+            self.a = r
+            self.cy = r > 0xff
+        elif row == 0x9:
+            c = self.cy
+            r = a - src - c
+            ac = (a & 0x0f) < (src & 0x0f) + c
+            ov = ((a ^ src) & (a ^ r) & 0x80) != 0
+            self.a = r
+            self.cy = r < 0
+        else:
+            self.a = {0x4: a | src, 0x5: a & src, 0x6: a ^ src}[row]
+            return
+        self.sfr[PSW] = (self.sfr[PSW] & ~0x40) | (0x40 if ac else 0)
+        self._ov(ov)
@@ -0,0 +1,64 @@
+"""lab3.asm's table-driven ADC_to_Volt and Volt_to_Temp in the 8051 simulator: every ADC
+code against the exact conversion, and the cycles against the mul32/div32 path it
+replaced (asm/math32_ref.asm stands in for math32.inc)."""
+import os
+import random
+
+from sim8051 import Asm, Sim
+
+HERE = os.path.dirname(__file__)
+LAB3 = os.path.join(HERE, '..', 'lab3.asm')
+MATH32 = os.path.join(HERE, 'asm', 'math32_ref.asm')
+
+
+def to_volt(sim, n):
+    """ADC_to_Volt of the 16-bit Decimate result n"""
+    sim.set_reg(0, n & 0xff)
+    sim.set_reg(1, n >> 8)
+    cycles = sim.call('ADC_to_Volt')
+    return sim.var('x', 4), cycles
+
+
+def test_every_code():
+    sim = Sim(Asm(LAB3))
+    vcc, full = sim['VCC_mV10'], sim['ADC_FULL']
+    codes = [code << 4 for code in range(4096)] # The 12-bit codes, without oversampling
+    codes += random.Random(2).sample(range(0x10000 - 16), 2000) # And the bits it adds
+    worst = 0
+    for n in codes:
+        volt, cycles = to_volt(sim, n)
+        exact = n*vcc/(16*full)
+        worst = max(worst, abs(volt - exact))
+    print('\nADC_to_Volt: worst error %.2f (1/10000 V) over %d inputs' % (worst, len(codes)))
+    assert worst < 1.5
+
+
+def test_temp():
+    sim = Sim(Asm(LAB3))
+    zero = sim['ZERO_C_mV10']
+    for volt in [0, 1000, zero - 1, zero, zero + 1, zero + 2500, 50300]:
+        sim.set_var('x', volt, 4)
+        sim.call('Volt_to_Temp')
+        assert sim.var('x', 4) == max(volt - zero, 0)
+
+
+def test_cycles():
+    sim = Sim(Asm(LAB3))
+    ref = Sim(Asm(MATH32))
+    table = volt_temp = 0
+    for n in range(0, 0x10000, 0x111):
+        volt, cycles = to_volt(sim, n)
+        table = max(table, cycles + sim.call('Volt_to_Temp'))
+
+        # What lab3.asm did before: x=code, mul32 by VCC, div32 by 4095, sub32 the 0C voltage
+        ref.set_var('x', n >> 4, 4)
+        ref.set_var('y', sim['VCC_mV10'], 4)
+        cycles = ref.call('mul32')
+        ref.set_var('y', sim['ADC_FULL'], 4)
+        cycles += ref.call('div32')
+        assert ref.var('x', 4) == (n >> 4)*sim['VCC_mV10']//sim['ADC_FULL']
+        ref.set_var('y', sim['ZERO_C_mV10'], 4)
+        volt_temp = max(volt_temp, cycles + ref.call('sub32'))
+    print('\nADC code to volts and degrees, standard 8051 machine cycles:')
+    print('  ADC_to_Volt+Volt_to_Temp %d, mul32+div32+sub32 %d' % (table, volt_temp))
+    assert table*10 < volt_temp
@@ -0,0 +1,16 @@
+"""Every assembly program in the tree assembles: jumps in range, no undefined names
+other than the LCD library routines, which are not in the tree."""
+import glob
+import os
+
+import pytest
+
+from sim8051 import Asm
+
+PROGRAMS = sorted(glob.glob(os.path.join(os.path.dirname(__file__), '..', '*.asm')))
+
+
+@pytest.mark.parametrize('path', PROGRAMS, ids=os.path.basename)
+def test_assembles(path):
+    asm = Asm(path)
+    assert set(asm.stubs) <= {'lcd_4bit'}
@@ -0,0 +1,49 @@
+"""bcd16.inc in the 8051 simulator, as lab3.asm includes it: Bin16_to_BCD against
+Python's own conversion, and the cycles against hex2bcd (asm/math32_ref.asm stands in
+for math32.inc)."""
+import os
+import random
+
+from sim8051 import Asm, Sim
+
+HERE = os.path.dirname(__file__)
+LAB3 = os.path.join(HERE, '..', 'lab3.asm')
+MATH32 = os.path.join(HERE, 'asm', 'math32_ref.asm')
+
+# The edges of every digit, and a spread of everything else
+VALUES = sorted(set([0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, 59999, 65535] +
+                    [d*10**k + e for k in range(5) for d in range(1, 7) for e in (-1, 0, 1)
+                     if 0 <= d*10**k + e <= 0xffff] +
+                    random.Random(3).sample(range(0x10000), 3000)))
+
+
+def packed(n, digits=10):
+    """n as little-endian packed BCD bytes"""
+    s = '%0*d' % (digits, n)
+    return [int(s[-2*i - 2])*16 + int(s[-2*i - 1]) for i in range(digits//2)]
+
+
+def test_bcd():
+    sim = Sim(Asm(LAB3))
+    bcd = sim['bcd']
+    for n in VALUES:
+        sim.iram[bcd:bcd + 5] = b'\xee'*5 # bcd+3 and bcd+4 have to be cleared too
+        sim.set_var('x', n | 0xabcd0000, 4) # Only the low 16 bits are converted
+        sim.call('Bin16_to_BCD')
+        assert list(sim.iram[bcd:bcd + 5]) == packed(n), n
+        assert sim.var('x', 2) == n
+
+
+def test_cycles():
+    sim = Sim(Asm(LAB3))
+    ref = Sim(Asm(MATH32))
+    bcd = hex2bcd = 0
+    for n in VALUES[::10]:
+        sim.set_var('x', n, 2)
+        bcd = max(bcd, sim.call('Bin16_to_BCD'))
+        ref.set_var('x', n, 4)
+        hex2bcd = max(hex2bcd, ref.call('hex2bcd'))
+        assert list(ref.iram[ref['bcd']:ref['bcd'] + 5]) == packed(n)
+    print('\n16-bit binary to decimal, standard 8051 machine cycles:')
+    print('  Bin16_to_BCD %d, hex2bcd %d' % (bcd, hex2bcd))
+    assert bcd*4 < hex2bcd
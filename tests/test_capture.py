@@ -0,0 +1,62 @@
+"""lab3_graph.py's capture files: what Recorder writes comes back from open_capture,
+seek_capture finds a time through the index records, and a recording that was cut off
+in the middle of a record, or before the first one, still opens for a replay."""
+import time
+
+import numpy as np
+
+from test_frame_decoder import load
+
+g = load({'np', 'os', 'sys', 'time', 'CAPTURE_MAGIC', 'RECORD', 'INDEX_CHANNEL',
+          'INDEX_EVERY', 'Recorder', 'open_capture', 'seek_capture'})
+
+
+def record(path, seconds, per_second):
+    """A capture with 'per_second' frames at each whole second, as if received then"""
+    rec = g['Recorder'](str(path))
+    n = 0
+    for s in range(seconds):
+        rec.t0 = time.monotonic() - s
+        value = np.arange(n, n + per_second, dtype=np.int32)
+        rec.write(np.full(per_second, 0x10, np.uint8), (value & 0xff).astype(np.uint8), value)
+        n += per_second
+    rec.file.close()
+    return n
+
+
+def frames(rec):
+    return rec[rec['channel'] != g['INDEX_CHANNEL']]
+
+
+def test_record_and_seek(tmp_path):
+    path = tmp_path / 'run.bin'
+    n = record(path, 20, 1000)
+    rec = g['open_capture'](str(path))
+    assert list(frames(rec)['value']) == list(range(n))
+    assert (rec['channel'] == g['INDEX_CHANNEL']).sum() == -(-n//g['INDEX_EVERY'])
+    for t in (0, 0.5, 3, 4.2, 12.999, 19, 25):
+        assert g['seek_capture'](rec, t) == np.searchsorted(rec['t'], t)
+
+
+def test_cut_off(tmp_path):
+    path = tmp_path / 'run.bin'
+    n = record(path, 10, 1000)
+    whole = np.array(g['open_capture'](str(path)))
+    with open(path, 'r+b') as f: # Stopped in the middle of writing a record
+        f.truncate(path.stat().st_size - 7)
+    rec = g['open_capture'](str(path))
+    assert len(rec) == len(whole) - 1
+    assert (np.array(rec) == whole[:-1]).all()
+    assert g['seek_capture'](rec, 5) == np.searchsorted(rec['t'], 5)
+    assert list(frames(rec)['value']) == list(range(n - 1))
+
+
+def test_no_records(tmp_path):
+    path = tmp_path / 'run.bin'
+    for size in (len(g['CAPTURE_MAGIC']), len(g['CAPTURE_MAGIC']) + 9):
+        record(path, 1, 10)
+        with open(path, 'r+b') as f:
+            f.truncate(size)
+        rec = g['open_capture'](str(path))
+        assert len(rec) == 0
+        assert g['seek_capture'](rec, 0) == 0
@@ -0,0 +1,167 @@
+// lab5.c fixed-point measurement math on the host: the phasor, phase and display path of
+// one measurement, against the float code it replaced, for accuracy on synthetic sines and
+// for speed.  The speed is in x86 TSC cycles of the host, which says nothing exact about
+// the 8051: the host has a hardware FPU, so the gap here is far smaller than on the 8051,
+// where every float operation is a library call.
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <x86intrin.h>
+
+#define VDD 3.3035 // As in lab5.c
+#define PHASOR_BLOCK 128
+#define PHASOR_N (PHASOR_BLOCK/2)
+#define HALF_WAVE 2.0
+#define TIMER0_HZ (72000000L/12L)
+
+// From lab5.c
+extern unsigned int phasor_block[PHASOR_BLOCK];
+void Phasor_DFT(unsigned int * x, long * re, long * im);
+long Phasor_Polar(long re, long im, unsigned int * rms_mV);
+char * Fixed_to_str(char * buff, long value, unsigned char decimals);
+
+// The float version from before the fixed-point change
+static float Phasor_RMS(long re, long im)
+{
+	return sqrtf((float)re*re+(float)im*im)*
+		(HALF_WAVE*2.0*4.0*VDD/(PHASOR_N*4096.0*16383.0*1.41421356237));
+}
+
+static float Phasor_Phase(long re, long im)
+{
+	return atan2f((float)im, (float)re)*(180.0/3.14159265359);
+}
+
+// Both measurement paths of main(), from the DFT bins to the two LCD lines
+__attribute__((noinline)) static void measure_float(long * bins, float period, char * l1, char * l2)
+{
+	float vmax1, vmax2, phaseDiff, timeDiff;
+
+	vmax1=Phasor_RMS(bins[0], bins[1]);
+	vmax2=Phasor_RMS(bins[2], bins[3]);
+	phaseDiff=Phasor_Phase(bins[2], bins[3])-Phasor_Phase(bins[0], bins[1])-360.0/PHASOR_BLOCK;
+	if(phaseDiff>180) phaseDiff-=360;
+	if(phaseDiff<=-180) phaseDiff+=360;
+	timeDiff=phaseDiff*period/360;
+	sprintf(l1, "PhaseDiff=%.2f", phaseDiff);
+	sprintf(l2, "V1=%.2f V2=%.2f", vmax1, vmax2);
+	(void)timeDiff;
+}
+
+__attribute__((noinline)) static void measure_fixed(long * bins, unsigned long period, char * l1, char * l2)
+{
+	unsigned int vmax1, vmax2;
+	long phaseDiff, timeDiff;
+	char n1[12], n2[12];
+
+	phaseDiff=Phasor_Polar(bins[2], bins[3], &vmax2)-Phasor_Polar(bins[0], bins[1], &vmax1)-360000L/PHASOR_BLOCK;
+	if(phaseDiff>180000L) phaseDiff-=360000L;
+	if(phaseDiff<=-180000L) phaseDiff+=360000L;
+	timeDiff=(phaseDiff/10)*(long)(period/(TIMER0_HZ/1000000L))/36000L;
+	phaseDiff=(phaseDiff+(phaseDiff<0?-5:5))/10;
+	vmax1=(vmax1+5)/10;
+	vmax2=(vmax2+5)/10;
+	sprintf(l1, "PhaseDiff=%s", Fixed_to_str(n1, phaseDiff, 2));
+	sprintf(l2, "V1=%s V2=%s", Fixed_to_str(n1, vmax1, 2), Fixed_to_str(n2, vmax2, 2));
+	(void)timeDiff;
+}
+
+// Fills the block as the ADC stream would: two interleaved channels over one period, the
+// second one sample later, negative half-cycles read as zero
+static void make_block(double a1, double a2, double phase_deg, long * bins)
+{
+	int j;
+	double w, v;
+
+	for(j=0; j<PHASOR_BLOCK; j++)
+	{
+		w=2.0*M_PI*j/PHASOR_BLOCK;
+		v=(j&1)?a2*sin(w+phase_deg*M_PI/180.0):a1*sin(w);
+		phasor_block[j]=(unsigned int)lround((v>0?v:0)*16383.0/VDD);
+	}
+	Phasor_DFT(&phasor_block[0], &bins[0], &bins[1]);
+	Phasor_DFT(&phasor_block[1], &bins[2], &bins[3]);
+}
+
+static int failures;
+
+static void check(int ok, const char * what)
+{
+	if(!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+#define CASES 64
+#define RUNS 2000
+
+int main(void)
+{
+	static long bins[CASES][4];
+	char l1[40], l2[40];
+	double a1, a2, ph, ref, err_mv=0, err_deg=0, err_ref_mv=0, err_ref_deg=0;
+	unsigned int v1, v2;
+	long p1, p2, d;
+	unsigned long long t, c_float, c_fixed;
+	int j, r;
+
+	// Accuracy: against the exact values and against the float code on the same bins
+	for(j=0; j<CASES; j++)
+	{
+		a1=0.2+3.0*(j%8)/8.0;
+		a2=3.1-2.5*(j%5)/5.0;
+		ph=-175.0+350.0*j/(CASES-1);
+		make_block(a1, a2, ph, bins[j]);
+		p1=Phasor_Polar(bins[j][0], bins[j][1], &v1);
+		p2=Phasor_Polar(bins[j][2], bins[j][3], &v2);
+		d=p2-p1-360000L/PHASOR_BLOCK;
+		if(d>180000L) d-=360000L;
+		if(d<=-180000L) d+=360000L;
+		err_mv=fmax(err_mv, fmax(fabs(v1-a1*1000.0/M_SQRT2), fabs(v2-a2*1000.0/M_SQRT2)));
+		err_deg=fmax(err_deg, fabs(d/1000.0-ph));
+		err_ref_mv=fmax(err_ref_mv, fabs(v1-1000.0*Phasor_RMS(bins[j][0], bins[j][1])));
+		ref=Phasor_Phase(bins[j][2], bins[j][3])-Phasor_Phase(bins[j][0], bins[j][1])-360.0/PHASOR_BLOCK;
+		if(ref>180) ref-=360;
+		if(ref<=-180) ref+=360;
+		err_ref_deg=fmax(err_ref_deg, fabs(d/1000.0-ref));
+	}
+	printf("lab5.c fixed-point phasors, %d synthetic sines 0.2V to 3.1V:\n", CASES);
+	printf("  worst error against the exact values: %.2f mV RMS, %.3f deg\n", err_mv, err_deg);
+	printf("  worst difference from the float code:  %.2f mV RMS, %.3f deg\n", err_ref_mv, err_ref_deg);
+	check(err_mv<5.0, "RMS within 5 mV of the exact value");
+	check(err_deg<0.1, "phase within 0.1 deg of the exact value");
+	check(err_ref_mv<1.5, "RMS within 1.5 mV of the float code");
+	check(err_ref_deg<0.02, "phase within 0.02 deg of the float code");
+
+	// Display formatting
+	check(strcmp(Fixed_to_str(l1, 1234, 2), "12.34")==0, "Fixed_to_str(1234, 2) is 12.34");
+	check(strcmp(Fixed_to_str(l1, -5, 2), "-0.05")==0, "Fixed_to_str(-5, 2) is -0.05");
+	check(strcmp(Fixed_to_str(l1, 0, 0), "0")==0, "Fixed_to_str(0, 0) is 0");
+	check(strcmp(Fixed_to_str(l1, -180000, 0), "-180000")==0, "Fixed_to_str(-180000, 0) is -180000");
+	measure_fixed(bins[0], 12000, l1, l2);
+	measure_float(bins[0], 12000/6.0e6, l1+20, l2+20);
+	printf("  same case, fixed: \"%s\" \"%s\", float: \"%s\" \"%s\"\n", l1, l2, l1+20, l2+20);
+
+	// Speed: best of several runs over all the cases, from the DFT bins to the LCD text
+	c_float=c_fixed=~0ULL;
+	for(r=0; r<RUNS; r++)
+	{
+		t=__rdtsc();
+		for(j=0; j<CASES; j++) measure_float(bins[j], 12000/6.0e6, l1, l2);
+		t=__rdtsc()-t;
+		if(t<c_float) c_float=t;
+		t=__rdtsc();
+		for(j=0; j<CASES; j++) measure_fixed(bins[j], 12000, l1, l2);
+		t=__rdtsc()-t;
+		if(t<c_fixed) c_fixed=t;
+	}
+	printf("  x86 TSC cycles per measurement on this host, not 8051 cycles (both phasors to both\n"
+		"  LCD lines): float %llu, fixed %llu.  With the host's FPU this understates the 8051 gap.\n",
+		c_float/CASES, c_fixed/CASES);
+
+	if(failures) return 1;
+	printf("test_fixed: OK\n");
+	return 0;
+}
@@ -0,0 +1,102 @@
+"""lab3_graph.py's FrameDecoder: frames split anywhere between reads, garbage and
+corrupted frames in the stream, sequence gaps, and how many frames a second it decodes.
+lab3_graph.py opens the serial port and the plot when it is run, so only the decoder's
+definitions are taken out of it."""
+import ast
+import os
+import random
+import struct
+import time
+
+HERE = os.path.dirname(__file__)
+GRAPH = os.path.join(HERE, '..', 'lab3_graph.py')
+NEEDED = {'np', 'SYNC', 'FRAME_LEN', 'crc8', 'CRC_TABLE', 'FrameDecoder'}
+
+
+def load(needed=NEEDED):
+    """Runs the imports, assignments and definitions of lab3_graph.py that bind 'needed'"""
+    with open(GRAPH) as f:
+        tree = ast.parse(f.read())
+    body = []
+    for node in tree.body:
+        if isinstance(node, (ast.Import, ast.ImportFrom)):
+            names = {a.asname or a.name for a in node.names}
+        elif isinstance(node, ast.Assign):
+            names = {t.id for t in node.targets if isinstance(t, ast.Name)}
+        elif isinstance(node, (ast.FunctionDef, ast.ClassDef)):
+            names = {node.name}
+        else:
+            continue
+        if names & needed:
+            body.append(node)
+    module = {}
+    exec(compile(ast.Module(body=body, type_ignores=[]), GRAPH, 'exec'), module)
+    return module
+
+
+g = load()
+
+
+def frame(channel, seq, value):
+    body = bytes([channel, seq & 0xff]) + struct.pack('<i', value)
+    return bytes([g['SYNC']]) + body + bytes([g['crc8'](body)])
+
+
+def frames(count, rand, first_seq=0):
+    return [(rand.choice([0x01, 0x02, 0x10, 0x20]), (first_seq + i) & 0xff,
+             rand.randrange(-2**31, 2**31)) for i in range(count)]
+
+
+def decode(stream, rand, max_chunk=50):
+    dec = g['FrameDecoder']()
+    out = []
+    i = 0
+    while i < len(stream):
+        n = rand.randint(1, max_chunk)
+        channel, seq, value = dec.feed(stream[i:i + n])
+        out += zip(channel.tolist(), seq.tolist(), value.tolist())
+        i += n
+    return out, dec
+
+
+def test_clean_stream():
+    rand = random.Random(5)
+    sent = frames(1000, rand, first_seq=200) # The sequence number wraps
+    out, dec = decode(b''.join(frame(*f) for f in sent), rand)
+    assert out == sent
+    assert dec.dropped == 0 and dec.bad == 0
+
+
+def test_garbage_and_corruption():
+    rand = random.Random(6)
+    sent = frames(1000, rand)
+    stream, kept = b'', []
+    for i, f in enumerate(sent):
+        data = frame(*f)
+        if i % 37 == 5: # One bit flipped: the CRC fails and the frame is lost
+            k = rand.randrange(1, 8)
+            data = data[:k] + bytes([data[k] ^ (1 << rand.randrange(8))]) + data[k + 1:]
+        else:
+            kept.append(f)
+        if i % 23 == 7: # Line noise between frames, some of it looking like a sync byte
+            stream += bytes(rand.choice([0xa5, rand.randrange(256)]) for j in range(rand.randint(1, 12)))
+        stream += data
+    out, dec = decode(stream, rand)
+    assert out == kept
+    assert dec.dropped == len(sent) - len(kept) # Seen as gaps in the sequence numbers
+    assert dec.bad > 0
+
+
+def test_throughput():
+    rand = random.Random(7)
+    stream = b''.join(frame(*f) for f in frames(200000, rand))
+    dec = g['FrameDecoder']()
+    count = 0
+    t = time.perf_counter()
+    for i in range(0, len(stream), 4096):
+        count += len(dec.feed(stream[i:i + 4096])[0])
+    t = time.perf_counter() - t
+    rate = count/t
+    print('\nFrameDecoder: %.0f frames/s in 4096-byte reads (115200 baud carries 1440 frames/s)' % rate)
+    assert count == 200000
+    assert rate > 10*1440
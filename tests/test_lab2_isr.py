@@ -0,0 +1,142 @@
+"""Lab2.asm's two interrupts in the 8051 simulator: what they do and the most cycles they
+take.  Timer2_ISR must keep the clock exact with its fractional reload, and Timer0_ISR
+must debounce the buttons into key events.  The worst cases are what the alarm clock's
+other code has to live with.  Clock_Tick's alarm check drives the PWM buzzer."""
+import os
+import random
+
+from sim8051 import Asm, Sim, SFRS, BITS
+
+LAB2 = os.path.join(os.path.dirname(__file__), '..', 'Lab2.asm')
+
+# Button number to port pin (P1 or P3 address, bit), as wired in Lab2.asm
+BUTTONS = [(SFRS['p1'], 5), (SFRS['p1'], 6), (SFRS['p3'], 0),
+           (SFRS['p1'], 0), (SFRS['p1'], 1), (SFRS['p1'], 2)]
+
+
+def start():
+    sim = Sim(Asm(LAB2))
+    sim.write(SFRS['sp'], 0x7f)
+    sim.sfr[SFRS['p1']] = sim.sfr[SFRS['p3']] = 0xff # Nothing pressed
+    return sim
+
+
+def interrupt(sim, vector, flag):
+    """One interrupt, from the vector.  Returns its cycles with the hardware LCALL."""
+    sim.set_bit(BITS[flag], 1)
+    return sim.call(vector, isr=True) + 2
+
+
+def test_timer2_period():
+    sim = start()
+    sim.call('Timer2_Init')
+    den, counts = sim['TICK_DEN'], sim['TICK_COUNTS']
+    total, cycles = 0, []
+    sim.set_var('Tick_Frac', random.Random(9).randrange(den), 2)
+    for tick in range(den): # A whole cycle of the fraction
+        cycles.append(interrupt(sim, 0x2b, 'tf2'))
+        period = 0x10000 - (sim.read(SFRS['rcmp2h']) << 8 | sim.read(SFRS['rcmp2l']))
+        assert period in (counts, counts + 1)
+        total += period
+        assert sim.flag('half_seconds_flag')
+        sim.set_flag('half_seconds_flag', 0)
+    # TICK_DEN ticks are 512 seconds, so CLK counts at CLK/512, give or take the fraction
+    # the test started with
+    assert abs(total - sim['CLK']) <= 1
+    print('\nTimer2_ISR: %d to %d machine cycles from the interrupt to RETI' % (min(cycles), max(cycles)))
+    assert max(cycles) < 50
+
+
+def test_alarm():
+    sim = start()
+    buzzer = lambda: sim.read(SFRS['piocon1']) >> 2 & 1 # PWM2 on P0.5
+    for name, value in (('time_sec_counter', 0x27), ('set_sec_counter', 0x30),
+                        ('time_min_counter', 0x15), ('set_min_counter', 0x15),
+                        ('time_hour_counter', 0x07), ('set_hour_counter', 0x07),
+                        ('Time_AP', 1), ('Set_AP', 1)):
+        sim.set_var(name, value)
+    ticks = 0
+    while not buzzer(): # Quiet until 7:15:30, the alarm time
+        sim.call('Clock_Tick')
+        ticks += 1
+        assert ticks < 10
+    assert sim.var('time_sec_counter') == 0x30
+    pattern = [buzzer()]
+    for i in range(5):
+        sim.call('Clock_Tick')
+        pattern.append(buzzer())
+    assert pattern == [1, 0, 1, 0, 1, 0] # Beep, silence, beep...
+
+
+def press(sim, buttons):
+    for n, (port, b) in enumerate(BUTTONS):
+        if n in buttons:
+            sim.sfr[port] &= ~(1 << b)
+        else:
+            sim.sfr[port] |= 1 << b
+
+
+def events(sim):
+    out = []
+    while True:
+        sim.call('Key_Get')
+        if sim.cy:
+            return out
+        out.append(sim.a)
+
+
+def scan(sim, buttons, samples):
+    press(sim, buttons)
+    return [interrupt(sim, 0x0b, 'tf0') for i in range(samples)]
+
+
+def test_debounce():
+    sim = start()
+    sim.call('Timer0_Init')
+    scan(sim, [], 10)
+    assert events(sim) == []
+    # Bounces of up to three samples are ignored
+    for i in range(5):
+        scan(sim, [1], 3)
+        scan(sim, [], 1)
+    scan(sim, [], 10)
+    assert events(sim) == []
+    # A press counts after four samples, once, and so does its release
+    scan(sim, [1], 4)
+    assert events(sim) == [1]
+    scan(sim, [1, 4], 6)
+    assert events(sim) == [4]
+    scan(sim, [], 10)
+    assert events(sim) == []
+
+
+def test_repeat():
+    sim = start()
+    sim.call('Timer0_Init')
+    start_rpt, next_rpt = sim['REPEAT_START'], sim['REPEAT_NEXT']
+    scan(sim, [3], 4 + start_rpt + 2*next_rpt)
+    assert events(sim) == [3, 0x83, 0x83, 0x83]
+
+
+def test_timer0_worst_case():
+    sim = start()
+    sim.call('Timer0_Init')
+    rand = random.Random(8)
+    cycles = []
+    for i in range(400): # Random button patterns, held long enough to count
+        buttons = [n for n in range(6) if rand.random() < 0.4]
+        cycles += scan(sim, buttons, rand.randint(1, 8))
+        events(sim)
+    # The worst case: all six pressed on the sample where the repeat comes due, so six
+    # presses and six repeats (the queue fills up)
+    scan(sim, [], 10)
+    scan(sim, range(6), 3)
+    events(sim)
+    sim.set_var('key_rpt', 1)
+    worst = scan(sim, range(6), 1)[0]
+    assert len(events(sim)) == sim['KEY_QUEUE_SIZE'] - 1
+    typical = sorted(cycles)[len(cycles)//2]
+    print('\nTimer0_ISR, machine cycles from the interrupt to RETI:')
+    print('  %d typical, %d worst of random patterns, %d worst case' % (typical, max(cycles), worst))
+    assert max(cycles) <= worst
+    assert worst < 400
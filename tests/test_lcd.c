@@ -0,0 +1,146 @@
+// lcd.c on the host: how long LCDprint() keeps the CPU in busy waits, against the
+// LCDprint() the shadow buffer replaced, with an HD44780 model checking that the screen
+// ends up the same.  Only the waits are timed: the few instructions between them are not.
+#include <stdio.h>
+#include <string.h>
+#include <XC.h>
+#include "lcd.h"
+
+extern void (*mock_hook)(void);
+
+// HD44780 in 4-bit mode: a nibble is latched while E is high, two make a byte
+static char ddram[0x80];
+static unsigned char lcd_ac; // Address counter
+static int nibble_latched, nibble_count, byte_count;
+static unsigned char nibble_high;
+
+static void lcd_model_byte(int rs, unsigned char x)
+{
+	byte_count++;
+	if(rs)
+	{
+		ddram[lcd_ac]=x;
+		lcd_ac=(lcd_ac+1)&0x7f;
+	}
+	else if(x&0x80)
+		lcd_ac=x&0x7f; // Set DDRAM address
+	else if(x==0x01)
+	{
+		memset(ddram, ' ', sizeof(ddram)); // Clear display
+		lcd_ac=0;
+	}
+}
+
+static void lcd_model_sample(void)
+{
+	unsigned char n;
+
+	if(!LCD_E)
+	{
+		nibble_latched=0;
+		return;
+	}
+	if(nibble_latched) return;
+	nibble_latched=1;
+	n=(LCD_D7<<3)|(LCD_D6<<2)|(LCD_D5<<1)|LCD_D4;
+	if((nibble_count++&1)==0)
+		nibble_high=n;
+	else
+		lcd_model_byte(LCD_RS, (nibble_high<<4)|n);
+}
+
+static void lcd_model_line(int line, char * s)
+{
+	memcpy(s, &ddram[line==2?0x40:0x00], CHARS_PER_LINE);
+	s[CHARS_PER_LINE]=0;
+}
+
+// LCDprint() before the shadow buffer: the whole line, 2ms after every character
+static void WriteData_baseline(unsigned char x)
+{
+	LCD_RS = 1;
+	LCD_byte(x);
+	waitms(2);
+}
+
+static void LCDprint_baseline(char * string, unsigned char line, unsigned char clear)
+{
+	int j;
+
+	WriteCommand(line==2?0xc0:0x80);
+	waitms(5);
+	for(j=0;string[j]!=0;j++)
+		WriteData_baseline(string[j]);
+	if(clear)
+		for(;j<CHARS_PER_LINE;j++)
+			WriteData_baseline(' ');
+}
+
+static int failures;
+
+// Prints one line of the table and checks the screen.  Returns the time in microseconds.
+static double run(const char * name, void (*print)(char *, unsigned char, unsigned char),
+	char * text, unsigned char line)
+{
+	unsigned long long start;
+	int bytes;
+	double us;
+	char shown[CHARS_PER_LINE+1], expect[CHARS_PER_LINE+1];
+
+	start=mock_cycles;
+	bytes=byte_count;
+	print(text, line, 1);
+	us=(mock_cycles-start)*1e6/SYSCLK;
+	bytes=byte_count-bytes;
+
+	snprintf(expect, sizeof(expect), "%-16s", text);
+	lcd_model_line(line, shown);
+	printf("  %-9s %-18s %3d bytes %9.0f us\n", name, text, bytes, us);
+	if(strcmp(shown, expect)!=0)
+	{
+		printf("FAIL: line %d shows \"%s\", expected \"%s\"\n", line, shown, expect);
+		failures++;
+	}
+	return us;
+}
+
+static void check(int ok, const char * what)
+{
+	if(!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	double t_full, t_digit, t_same, b_full, b_digit, b_same;
+
+	mock_hook=lcd_model_sample;
+	LCD_4BIT();
+
+	printf("lcd.c LCDprint(), simulated busy-wait time per call:\n");
+	t_full =run("shadow", LCDprint, "Capacitance", 1);
+	run("shadow", LCDprint, "C= 12.34nF", 2);
+	t_digit=run("shadow", LCDprint, "C= 12.35nF", 2);
+	t_same =run("shadow", LCDprint, "C= 12.35nF", 2);
+
+	LCD_4BIT(); // Same starting point for the old driver
+	b_full =run("baseline", LCDprint_baseline, "Capacitance", 1);
+	run("baseline", LCDprint_baseline, "C= 12.34nF", 2);
+	b_digit=run("baseline", LCDprint_baseline, "C= 12.35nF", 2);
+	b_same =run("baseline", LCDprint_baseline, "C= 12.35nF", 2);
+
+	printf("  speedup: new line %.0fx, one digit %.0fx, unchanged line: %.0f us instead of %.0f us\n",
+		b_full/t_full, b_digit/t_digit, t_same, b_same);
+
+	check(b_digit>40000.0, "the old driver takes about 45ms per line");
+	check(t_digit<500.0, "one changed digit costs less than 0.5ms");
+	check(t_same==0.0, "an unchanged line sends nothing");
+	check(t_full<3000.0, "a new line costs less than 3ms");
+
+	if(failures) return 1;
+	printf("test_lcd: OK\n");
+	return 0;
+}
@@ -0,0 +1,93 @@
+"""lab3.asm's oversampling in the 8051 simulator: Timer2_ISR alternates the two ADC
+channels and adds up 2^OVERSAMPLE_BITS conversions of each, and Decimate scales the sums
+to 16 bits.  The ADC model gives every conversion its own noisy 12-bit result."""
+import os
+import random
+
+import pytest
+
+from sim8051 import Asm, Sim, SFRS, BITS
+
+LAB3 = os.path.join(os.path.dirname(__file__), '..', 'lab3.asm')
+
+
+class Adc:
+    """Setting ADCS converts the channel selected in ADCCON0 right away: the result is
+    ready long before the next Timer 2 interrupt."""
+
+    def __init__(self, sim, levels, noise, seed):
+        self.levels = levels # Mean code of each channel
+        self.noise = noise
+        self.rand = random.Random(seed)
+        self.samples = {channel: [] for channel in levels}
+        sim.sfr_write[SFRS['adccon0']] = self.write
+
+    def write(self, sim, value):
+        if not value & 0x40: # ADCS
+            return
+        channel = value & 0x0f
+        code = min(max(self.levels[channel] + self.rand.randint(-self.noise, self.noise), 0), 4095)
+        self.samples[channel].append(code)
+        sim.sfr[SFRS['adcrh']] = code >> 4
+        sim.sfr[SFRS['adcrl']] = (code & 0x0f) | 0xa0 # The upper bits of ADCRL are not the result
+        sim.sfr[SFRS['adccon0']] = (value & ~0x40) | 0x80 # Done: ADCF
+
+
+def start(bits, levels, noise=6, seed=4):
+    sim = Sim(Asm(LAB3, {'OVERSAMPLE_BITS': bits}))
+    sim.write(SFRS['sp'], 0x7f)
+    adc = Adc(sim, levels, noise, seed)
+    sim.call('Timer2_Init')
+    return sim, adc
+
+
+def timer2_interrupt(sim):
+    """One Timer 2 overflow, from the vector.  Returns its cycles with the hardware LCALL."""
+    sim.set_bit(BITS['tf2'], 1)
+    return sim.call(0x2b, isr=True) + 2
+
+
+def decimate(sim, name):
+    sim.set_reg(0, sim[name])
+    sim.call('Decimate')
+    return sim.reg(1) << 8 | sim.reg(0)
+
+
+@pytest.mark.parametrize('bits', [4, 7, 8])
+def test_readings(bits):
+    n = 1 << bits
+    sim, adc = start(bits, {0: 2590, 7: 1234})
+    for reading in range(3):
+        # Channel 0's first conversion was started by the interrupt before the reading
+        led, sig = len(adc.samples[0]) - 1, len(adc.samples[7])
+        for i in range(2*n):
+            assert not sim.flag('adc_ready')
+            timer2_interrupt(sim)
+            assert not sim.bit(BITS['tf2'])
+        assert sim.flag('adc_ready')
+        sim.set_flag('adc_ready', 0)
+        sum_led = sum(adc.samples[0][led:led + n])
+        sum_sig = sum(adc.samples[7][sig:sig + n])
+        assert sim.var('adc_out_led', 3) == sum_led
+        assert sim.var('adc_out_sig', 3) == sum_sig
+        assert decimate(sim, 'adc_out_led') == sum_led >> (bits - 4)
+        assert decimate(sim, 'adc_out_sig') == sum_sig >> (bits - 4)
+
+
+@pytest.mark.parametrize('bits', [4, 8])
+def test_full_scale(bits):
+    sim, adc = start(bits, {0: 4095, 7: 0}, noise=0)
+    for i in range(2 << bits):
+        timer2_interrupt(sim)
+    assert decimate(sim, 'adc_out_led') == 0xfff0
+    assert decimate(sim, 'adc_out_sig') == 0
+
+
+def test_isr_cycles():
+    sim, adc = start(7, {0: 4095, 7: 4095}, noise=0)
+    cycles = [timer2_interrupt(sim) for i in range(3*256)]
+    sim.set_reg(0, sim['adc_out_led'])
+    decimate_cycles = sim.call('Decimate')
+    print('\nTimer2_ISR, standard 8051 machine cycles from the interrupt to RETI:')
+    print('  %d usually, %d when a reading completes; Decimate %d' % (min(cycles), max(cycles), decimate_cycles))
+    assert max(cycles) < 120
@@ -0,0 +1,203 @@
+// lab6.c's cooperative scheduler on the host, with the core timer tick from pic32_mock.c.
+// The task table's functions are swapped for stubs that log when they run and take a set
+// time, to check the periods, the order of tasks due on the same tick, and that a task
+// held up by a slow one skips its missed runs instead of bursting.  Then the real tasks
+// run with a reading to show, and their longest runs are reported.
+#include <stdio.h>
+#include <string.h>
+#include <XC.h>
+#include "lcd.h"
+
+#define POLL_CYCLES 40 // SYSCLK cycles of one pass of the scheduler loop with nothing due
+#define STEP_CYCLES 400 // A stub task takes its time in steps this long, so the tick goes on
+
+extern void (*mock_hook)(void);
+
+// From lab6.c
+struct task
+{
+	void (*run)(void);
+	unsigned int period_ms;
+	unsigned int next;
+	unsigned int worst;
+};
+extern struct task tasks[];
+extern volatile unsigned int tick_ms;
+extern int periods;
+extern float T, capacitance;
+extern unsigned char reading_shown;
+extern char display_buffer_2[17];
+void CoreTimer_Handler(void);
+void Tick_Init(void);
+void UART2Configure(int baud_rate);
+void PeriodCapture_Init(void);
+void Scheduler_Init(void);
+void Scheduler_Poll(void);
+
+#define TASKS 4
+
+static void run_interrupts(void)
+{
+	if(mock_interrupts_enabled && IEC0bits.CTIE && IFS0bits.CTIF) CoreTimer_Handler();
+}
+
+static int failures;
+
+static void check(int ok, const char * what)
+{
+	if(!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// Stub tasks: each logs the tick it ran on and then takes stub_us[] of simulated time
+#define LOG_SIZE 2000
+
+static struct { unsigned int tick; int task; } run_log[LOG_SIZE];
+static int log_count;
+static unsigned int stub_us[TASKS];
+
+static void stub(int n)
+{
+	unsigned long long end;
+
+	if(log_count<LOG_SIZE)
+	{
+		run_log[log_count].tick=tick_ms;
+		run_log[log_count].task=n;
+		log_count++;
+	}
+	end=mock_cycles+(unsigned long long)stub_us[n]*(SYSCLK/1000000L);
+	while(mock_cycles<end) mock_advance(STEP_CYCLES);
+}
+
+static void stub0(void) { stub(0); }
+static void stub1(void) { stub(1); }
+static void stub2(void) { stub(2); }
+static void stub3(void) { stub(3); }
+static void (*stubs[TASKS])(void)={stub0, stub1, stub2, stub3};
+static void (*real[TASKS])(void);
+
+static void run_ms(unsigned int ms)
+{
+	unsigned int start=tick_ms;
+
+	while(tick_ms-start<ms)
+	{
+		Scheduler_Poll();
+		mock_advance(POLL_CYCLES);
+	}
+}
+
+static void start(int use_stubs)
+{
+	int i;
+
+	for(i=0; i<TASKS; i++)
+	{
+		tasks[i].run=use_stubs?stubs[i]:real[i];
+		tasks[i].worst=0;
+	}
+	log_count=0;
+	mock_interrupts_enabled=1;
+	Tick_Init();
+	Scheduler_Init();
+}
+
+static int runs_of(int n, unsigned int * ticks)
+{
+	int j, count=0;
+
+	for(j=0; j<log_count; j++) if(run_log[j].task==n) ticks[count++]=run_log[j].tick;
+	return count;
+}
+
+// Light load: every task runs on its period from the start, and tasks due on the same
+// tick run in table order
+static void test_periods(void)
+{
+	unsigned int ticks[LOG_SIZE];
+	int i, j, n, off=0, order=0;
+
+	for(i=0; i<TASKS; i++) stub_us[i]=100;
+	start(1);
+	run_ms(1000);
+	for(i=0; i<TASKS; i++)
+	{
+		n=runs_of(i, ticks);
+		check(n==1000/tasks[i].period_ms, "each task runs once per period");
+		for(j=0; j<n; j++) if(ticks[j]!=j*tasks[i].period_ms) off++;
+	}
+	check(off==0, "every run is on its period");
+	for(j=1; j<log_count; j++)
+		if(run_log[j].tick==run_log[j-1].tick && run_log[j].task<=run_log[j-1].task) order++;
+	check(order==0, "tasks due on the same tick run in table order");
+	check(log_count>4 && run_log[0].task==0 && run_log[3].task==3, "all four run on the first tick");
+}
+
+// Task 2 (the LCD's slot) takes 45ms: the 20ms task misses runs and must not make them
+// up back to back
+static void test_overload(void)
+{
+	unsigned int ticks[LOG_SIZE];
+	int i, j, n, burst=0, missed=0;
+
+	for(i=0; i<TASKS; i++) stub_us[i]=100;
+	stub_us[2]=45000;
+	start(1);
+	run_ms(2000);
+	n=runs_of(0, ticks);
+	for(j=1; j<n; j++)
+	{
+		if(ticks[j]==ticks[j-1]) burst++;
+		if(ticks[j]-ticks[j-1]>tasks[0].period_ms) missed++;
+	}
+	check(missed>0, "the slow task held the 20ms task up");
+	check(burst==0, "missed runs are skipped, not run back to back");
+	check(n<=2000/tasks[0].period_ms, "never more runs than periods");
+	check(tasks[2].worst/(SYSCLK/2000000L)>=45000, "the slow task's worst run is recorded");
+	printf("  45ms task in the table: the 20ms task ran %d times in 2s instead of %d\n",
+		n, (int)(2000/tasks[0].period_ms));
+}
+
+// The real tasks with no input signal and a reading left to show.  Only the timer reads
+// and the LCD's waits take simulated time, so this is the LCD line's cost.
+static void test_real_tasks(void)
+{
+	static const char * names[TASKS]={"Measure", "Range", "LCD", "Console"};
+	int i;
+
+	UART2Configure(115200);
+	LCD_4BIT();
+	PeriodCapture_Init();
+	start(0);
+	periods=10;
+	T=1.0e-3;
+	capacitance=0.4809;
+	reading_shown=0;
+	run_ms(1000);
+	check(strcmp(display_buffer_2, "C= 0.48uF")==0, "Range_Task formats the reading");
+	printf("  real tasks, longest run:");
+	for(i=0; i<TASKS; i++) printf(" %s %uus", names[i], (unsigned int)(tasks[i].worst/(SYSCLK/2000000L)));
+	printf("\n");
+	check(tasks[2].worst/(SYSCLK/2000000L)<tasks[0].period_ms*1000, "one LCD line takes less than a Measure period");
+}
+
+int main(void)
+{
+	int i;
+
+	for(i=0; i<TASKS; i++) real[i]=tasks[i].run;
+	mock_hook=run_interrupts;
+
+	printf("lab6.c scheduler:\n");
+	test_periods();
+	test_overload();
+	test_real_tasks();
+
+	if(failures) return 1;
+	printf("test_sched: OK\n");
+	return 0;
+}
@@ -0,0 +1,96 @@
+"""serial_tx.inc as lab3.asm uses it, in the 8051 simulator: the bytes come out of the
+UART complete and in order, and the program only spends a few cycles per byte instead
+of waiting for the UART as putchar does."""
+import os
+import random
+
+from sim8051 import Asm, Sim, SFRS, BITS
+
+LAB3 = os.path.join(os.path.dirname(__file__), '..', 'lab3.asm')
+
+CLK = 16600000
+BAUD = 115200
+BYTE_CYCLES = CLK//12*10//BAUD # Machine cycles to send one byte: what putchar waits
+
+
+class Uart:
+    """A byte written to SBUF is on the wire for BYTE_CYCLES, then TI is set."""
+
+    def __init__(self, sim):
+        self.sent = []
+        self.done_at = None
+        sim.sfr_write[SFRS['sbuf']] = self.write
+        sim.hooks.append(self.tick)
+        sim.interrupts.append((0x23, lambda s: (s.bit(BITS['ti']) or s.bit(BITS['ri'])) and s.bit(BITS['es'])))
+
+    def write(self, sim, value):
+        assert self.done_at is None, 'SBUF written while the UART was still sending'
+        self.sent.append(value)
+        self.done_at = sim.cycles + BYTE_CYCLES
+
+    def tick(self, sim):
+        if self.done_at is not None and sim.cycles >= self.done_at:
+            self.done_at = None
+            sim.set_bit(BITS['ti'], 1)
+
+    def idle(self, sim):
+        return self.done_at is None and not sim.flag('txq_busy')
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+
+def start():
+    sim = Sim(Asm(LAB3))
+    sim.write(SFRS['sp'], 0x7f)
+    uart = Uart(sim)
+    sim.call('Serial_Init')
+    return sim, uart
+
+
+def test_bytes_arrive_in_order():
+    sim, uart = start()
+    data = [random.Random(1).randrange(256) for i in range(300)] # Wraps the 32-byte queue many times
+    for b in data:
+        sim.a = b
+        sim.call('Serial_Put')
+    sim.wait(uart.idle)
+    assert uart.sent == data
+    assert sim.var('txq_head') == sim.var('txq_tail')
+
+
+def test_put_cycle_budget():
+    sim, uart = start()
+    size = sim['TXQ_SIZE']
+    cycles = []
+    for i in range(size - 1): # Until the queue is full: none of these has to wait
+        sim.a = i
+        cycles.append(sim.call('Serial_Put'))
+    sim.wait(uart.idle)
+    isr = max(sim.isr_log)
+    print('\nserial_tx.inc, standard 8051 machine cycles:')
+    print('  Serial_Put %d to %d per byte, Serial_ISR at most %d per byte,' % (min(cycles), max(cycles), isr))
+    print('  putchar waits %d per byte at %d baud' % (BYTE_CYCLES, BAUD))
+    assert max(cycles) <= 30
+    assert isr <= 40
+    assert max(cycles) + isr < BYTE_CYCLES # The UART is never left waiting for the next byte
+
+
+def test_frame():
+    sim, uart = start()
+    sim.set_var('tx_seq', 7)
+    sim.set_var('x', 0x12345678, 4)
+    sim.a = sim['TELEMETRY_TEMP']
+    cycles = sim.call('Send_Frame')
+    sim.wait(uart.idle)
+    body = [sim['TELEMETRY_TEMP'], 7, 0x78, 0x56, 0x34, 0x12]
+    assert uart.sent == [0xa5] + body + [crc8(body)]
+    assert sim.var('tx_seq') == 8
+    print('\nSend_Frame: %d machine cycles for 8 bytes, putchar would take at least %d' % (cycles, 8*BYTE_CYCLES))
+    assert cycles < 8*BYTE_CYCLES # Most of it is the bit-wise CRC
@@ -0,0 +1,173 @@
+// The Timer 3 system tick of lab4.c and lab5.c (the same code in both) against the
+// simulated Timer 3 in efm8_mock.c: the tick never goes backwards and keeps up with the
+// timer, an overflow the ISR hasn't seen yet still counts, deadlines work across the wrap
+// of tick_ms, and the software timers neither drift nor burst after falling behind.
+#include <stdio.h>
+
+#define TICK_COUNTS_PER_US 6 // SYSCLK/12 at 72MHz, as in the firmware
+
+// From the firmware
+extern volatile unsigned char EA;
+extern volatile unsigned long tick_ms;
+void TIMER3_Init(void);
+unsigned long Tick_ms(void);
+unsigned long Tick_us(void);
+unsigned long Deadline_ms(unsigned int ms);
+unsigned char Expired(unsigned long deadline);
+void SoftTimer_Start(unsigned char n, unsigned int period_ms);
+unsigned char SoftTimer_Expired(unsigned char n);
+void waitms(unsigned int ms);
+void Timer3us(unsigned char us);
+
+// From efm8_mock.c
+extern unsigned int mock_tmr3_step;
+extern unsigned long long mock_tmr3_counts;
+
+static int failures;
+
+static void check(int ok, const char * what)
+{
+	if(!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static unsigned long long now_us(void)
+{
+	return mock_tmr3_counts/TICK_COUNTS_PER_US;
+}
+
+static void start(unsigned int step)
+{
+	mock_tmr3_step=step;
+	TIMER3_Init();
+	mock_tmr3_counts=0;
+	EA=1;
+}
+
+// Tick_us() against the simulated time, with different times between the timer reads so
+// the timer rolls over at every point of them.  At more than about 50 counts (8 us) the
+// high-low-high read in Timer3_Count() rarely matches, which the chip never does.
+static void test_monotonic(unsigned int step)
+{
+	unsigned long t, last=0;
+	long long lag, worst=0;
+	int backwards=0;
+
+	start(step);
+	while(now_us()<200000)
+	{
+		t=Tick_us();
+		if(t<last) backwards++;
+		last=t;
+		lag=(long long)now_us()-t;
+		if(lag<0) lag=-lag;
+		if(lag>worst) worst=lag;
+	}
+	printf("  step %3u counts: Tick_us() within %lld us of the timer over 200 ms\n", step, worst);
+	check(backwards==0, "Tick_us() never goes backwards");
+	check(worst<=step/TICK_COUNTS_PER_US+2, "Tick_us() keeps up with Timer 3");
+	check(Tick_ms()==now_us()/1000, "Tick_ms() counts the milliseconds");
+}
+
+// With interrupts off the ISR can't count the overflow, but Tick_ms() still must
+static void test_pending_overflow(void)
+{
+	unsigned long before, pending, after;
+
+	start(4);
+	waitms(3);
+	before=Tick_ms();
+	EA=0;
+	while(now_us()<(before+1)*1000+100) Tick_ms(); // Past the next overflow
+	pending=Tick_ms();
+	check(tick_ms==before, "the ISR did not run with EA=0");
+	check(pending==before+1, "Tick_ms() counts the overflow the ISR hasn't seen");
+	EA=1;
+	after=Tick_ms();
+	check(tick_ms==before+1, "the ISR ran once EA was set");
+	check(after==pending, "no double count once the ISR runs");
+}
+
+// The host's long is 64 bits, so this wraps there instead of at SDCC's 32 bits.  The
+// arithmetic is the same.
+static void test_deadline_wrap(void)
+{
+	unsigned long deadline;
+
+	start(4);
+	tick_ms=~0UL-100;
+	deadline=Deadline_ms(300); // Past the wrap
+	check(deadline<200, "the deadline wrapped");
+	check(!Expired(deadline), "not expired at the start");
+	waitms(150); // tick_ms wraps in here
+	check(tick_ms<100, "tick_ms wrapped");
+	check(!Expired(deadline), "not expired after the wrap");
+	waitms(160);
+	check(Expired(deadline), "expired after 300 ms");
+}
+
+static void test_waits(void)
+{
+	unsigned long long t;
+
+	start(4);
+	t=now_us();
+	waitms(20);
+	t=now_us()-t;
+	check(t>=20000 && t<20010, "waitms(20) waits 20 ms");
+	t=now_us();
+	Timer3us(40);
+	t=now_us()-t;
+	check(t>=40 && t<43, "Timer3us(40) waits 40 us");
+}
+
+#define PERIOD 250
+
+static void test_soft_timer(void)
+{
+	unsigned long fired[64];
+	int n=0, k, late=0;
+	unsigned long long t0;
+
+	start(4);
+	t0=now_us();
+	SoftTimer_Start(1, PERIOD);
+	while(now_us()-t0<10000000ULL) // 10 s, polled all the time
+	{
+		if(SoftTimer_Expired(1) && n<64) fired[n++]=(now_us()-t0)/1000;
+	}
+	check(n==10000/PERIOD, "fires once per period");
+	for(k=0; k<n; k++) if(fired[k]<(unsigned long)PERIOD*(k+1) || fired[k]>(unsigned long)PERIOD*(k+1)+1) late++;
+	check(late==0, "fires on the period, without drift");
+
+	// Not polled for over three periods: one late expiry, then a whole period again
+	t0=now_us();
+	while(now_us()-t0<(PERIOD*3+100)*1000ULL) Tick_ms();
+	check(SoftTimer_Expired(1), "a late expiry is seen");
+	check(!SoftTimer_Expired(1), "but only once, not one per missed period");
+	t0=now_us();
+	while(!SoftTimer_Expired(1));
+	t0=(now_us()-t0)/1000;
+	check(t0>=PERIOD-1 && t0<=PERIOD, "the next one is a full period later");
+	printf("  soft timer: %d expiries in 10 s, none off the %d ms grid\n", n, PERIOD);
+}
+
+int main(void)
+{
+	unsigned int steps[]={1, 4, 7, 31, 50};
+	unsigned int j;
+
+	printf("Timer 3 tick and software timers:\n");
+	for(j=0; j<sizeof(steps)/sizeof(steps[0]); j++) test_monotonic(steps[j]);
+	test_pending_overflow();
+	test_deadline_wrap();
+	test_waits();
+	test_soft_timer();
+
+	if(failures) return 1;
+	printf("test_tick: OK\n");
+	return 0;
+}